@@ -0,0 +1,222 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include "audio.h"
+
+#define WAVHEADER 44                                        // Bytes before the samples of a WAV file
+#define WAVCHUNK 1024                                       // Samples made at a time for a file
+
+char *wav_path = NULL;
+int audio_samples = AUDIO_SAMPLES;
+int mute = 0;
+
+static AUDIO *new_audio(unsigned int rate)
+{
+    AUDIO *A = calloc(1, sizeof(AUDIO));
+
+    if(A == NULL)
+        return NULL;
+    A->rate = rate;
+    A->step = (uint32_t)(((uint64_t)BEEP_HZ << 32) / rate);
+    atomic_init(&A->head, 0);
+    atomic_init(&A->tail, 0);
+    return A;
+}
+
+static void attach(CH *C8, AUDIO *A)                        // From here the CPU posts its edges
+{
+    C8->audio = A;
+    sound_edge(A, C8);                                      // A beep already going
+}
+
+void fill_audio(AUDIO *A, int16_t *out, int n)
+{
+    unsigned int head = atomic_load_explicit(&A->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&A->tail, memory_order_acquire);
+    long long when;
+    uint64_t edge;
+    int i = 0, at;
+
+    while(i < n)
+    {
+        at = n;
+        if(head != tail)
+        {
+            edge = A->ring[head % AUDIOQ];
+            when = (long long)(edge >> 1) + A->offset - (long long)A->clock; // Sample of this buffer it falls on
+            if(!A->exact && (!A->synced || when < i - 2 * (long long)A->lead || when > i + (long long)A->rate / 10))
+            {                                               // First edge, or the clocks drifted apart: place it a buffer ahead
+                A->offset = (long long)A->clock + i + A->lead - (long long)(edge >> 1);
+                when = i + A->lead;
+                A->synced = 1;
+                A->resyncs++;
+            }
+            if(when <= i){                                  // Due, or a little late: now
+                A->playing = edge & 1;
+                head++;
+                continue;
+            }
+            if(when < n)
+                at = when;
+        }
+        if(A->playing)
+            for(; i < at; i++, A->phase += A->step)
+                out[i] = A->phase & 0x80000000 ? BEEP_VOLUME : -BEEP_VOLUME;
+        else
+            for(; i < at; i++)
+                out[i] = 0;
+    }
+    atomic_store_explicit(&A->head, head, memory_order_release);
+    A->clock += n;
+}
+
+static void callback(void *userdata, Uint8 *stream, int len) // SDL's audio thread: no locks, no allocation
+{
+    fill_audio(userdata, (int16_t *)stream, len / sizeof(int16_t));
+}
+
+int open_audio(CH *C8)
+{
+    SDL_AudioSpec want, have;
+    AUDIO *A;
+
+    if(SDL_InitSubSystem(SDL_INIT_AUDIO) != 0 || (A = new_audio(AUDIO_RATE)) == NULL)
+        return -1;
+
+    memset(&want, 0, sizeof(want));
+    want.freq = AUDIO_RATE;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = audio_samples;
+    want.callback = callback;
+    want.userdata = A;
+    if((A->device = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE)) == 0){
+        fprintf(stderr, "No sound: %s\n", SDL_GetError());
+        free(A);
+        return -1;
+    }
+    A->rate = have.freq;                                    // Before the CPU posts anything
+    A->step = (uint32_t)(((uint64_t)BEEP_HZ << 32) / have.freq);
+    A->lead = have.samples;
+    attach(C8, A);
+    SDL_PauseAudioDevice(A->device, 0);
+    return 0;
+}
+
+static void put32(unsigned char *p, uint32_t v)             // WAV is little endian whatever the host is
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void wav_header(FILE *out, unsigned int rate, uint32_t samples)
+{
+    unsigned char h[WAVHEADER];
+
+    memcpy(h, "RIFF", 4);
+    put32(h + 4, WAVHEADER - 8 + samples * 2);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put32(h + 16, 16);                                      // PCM, mono, 16 bits
+    put32(h + 20, 1 | 1 << 16);
+    put32(h + 24, rate);
+    put32(h + 28, rate * 2);
+    put32(h + 32, 2 | 16 << 16);
+    memcpy(h + 36, "data", 4);
+    put32(h + 40, samples * 2);
+    fwrite(h, 1, WAVHEADER, out);
+}
+
+int open_wav(CH *C8, const char *path)
+{
+    AUDIO *A;
+    FILE *out;
+
+    if((out = fopen(path, "wb")) == NULL){
+        fprintf(stderr, "Can't write %s\n", path);
+        return -1;
+    }
+    if((A = new_audio(AUDIO_RATE)) == NULL){
+        fclose(out);
+        return -1;
+    }
+    wav_header(out, A->rate, 0);                            // Sizes filled in by close_audio()
+    A->wav = out;
+    A->exact = 1;
+    A->synced = 1;
+    attach(C8, A);
+    return 0;
+}
+
+void write_wav(CH *C8)
+{
+    AUDIO *A = C8->audio;
+    int16_t samples[WAVCHUNK];
+    unsigned char bytes[2 * WAVCHUNK];
+    unsigned long long upto;
+    int i, n;
+
+    if(A == NULL || A->wav == NULL)
+        return;
+    upto = (A->ticks * C8->ipf + C8->tick) * A->rate / (60ULL * C8->ipf);
+    while(A->clock < upto)
+    {
+        n = upto - A->clock < WAVCHUNK ? (int)(upto - A->clock) : WAVCHUNK;
+        fill_audio(A, samples, n);
+        for(i = 0; i < n; i++){
+            bytes[2 * i] = samples[i];
+            bytes[2 * i + 1] = (uint16_t)samples[i] >> 8;
+        }
+        fwrite(bytes, 2, n, A->wav);
+    }
+}
+
+void hush_audio(CH *C8)
+{
+    if(C8->audio != NULL && C8->audio->on)
+        post_edge(C8->audio, C8->audio->ticks, C8->tick, C8->ipf, 0);
+}
+
+void close_audio(CH *C8)
+{
+    AUDIO *A = C8->audio;
+
+    if(A == NULL)
+        return;
+    if(A->device != 0)
+        SDL_CloseAudioDevice(A->device);                    // Waits for the callback to return
+    if(A->wav != NULL){
+        write_wav(C8);
+        rewind(A->wav);
+        wav_header(A->wav, A->rate, A->clock);
+        fclose(A->wav);
+    }
+    if(A->dropped > 0)
+        fprintf(stderr, "audio: %lu edges found the ring full\n", A->dropped);
+    free(A);
+    C8->audio = NULL;
+}
@@ -0,0 +1,115 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+
+#ifndef AUDIO_H_INCLUDED
+#define AUDIO_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "chip8.h"
+
+#define AUDIOQ 1024                     // Edges the ring holds, a power of two
+#define AUDIO_RATE 48000                // Samples a second asked of the device and written to WAV files
+#define AUDIO_SAMPLES 256               // Samples per callback unless -audio says otherwise: 5.3 ms at 48 kHz
+#define BEEP_HZ 440                     // Pitch of the buzzer
+#define BEEP_VOLUME 3000                // Amplitude of the square wave, out of 32767
+
+
+/*
+ * The buzzer. An instance with an AUDIO hung off CH.audio tells it each
+ * time the sound goes on or off: FX18 and the 60 Hz tick of the timers
+ * post an edge, the sample of the machine's own clock it happened at,
+ * worked out from the ticks so far and the instruction within the tick.
+ * The edges go through a ring with one writer, the CPU, and one reader,
+ * the sink. The CPU never waits on it: when the ring is full the edge is
+ * dropped and posted again on the next tick.
+ *
+ * The sink turns the edges into a square wave, sample-accurately. Behind
+ * an SDL device it runs in the audio callback, with no locks and no
+ * allocation, and maps the machine's clock onto the device's one buffer
+ * ahead of what is being played, resyncing when the two drift apart, as
+ * they do while the machine sleeps or runs in turbo. Behind a WAV file
+ * it is run by the headless driver up to where the machine is, on the
+ * machine's clock exactly. Without a sink CH.audio is NULL and costs one
+ * test per tick.
+ */
+
+
+typedef struct Audio                    // begin audio struct
+{
+
+    uint64_t ring[AUDIOQ];              // Edges: the machine's sample shifted left once, the low bit set when the sound goes on
+    atomic_uint head;                   // Next edge for the sink, moved by the sink only
+    atomic_uint tail;                   // Next edge to fill, moved by the CPU only
+    unsigned int rate;                  // Samples a second
+    unsigned long long ticks;           // 60 Hz ticks since it was attached. The CPU's side from here
+    int on;                             // Whether the last edge posted turned the sound on
+    unsigned long dropped;              // Edges that found the ring full
+    unsigned long long clock;           // Samples the sink made. The sink's side from here
+    long long offset;                   // Added to a sample of the machine gives the one of the sink
+    unsigned int lead;                  // How far ahead of the sink edges are placed on a resync, one buffer
+    int synced;                         // Set once offset means something
+    int exact;                          // Keep to the machine's clock and never resync, for files
+    int playing;                        // The sound is on at the sink
+    uint32_t phase;                     // Of the square wave, a full turn is 2^32
+    uint32_t step;                      // Phase a sample
+    unsigned long resyncs;
+    unsigned int device;                // SDL audio device, 0 when writing a file
+    FILE *wav;                          // The file, NULL when playing on a device
+
+}AUDIO;                                 // end audio struct
+
+
+extern char *wav_path;                  // Where a headless run writes its sound, NULL for none
+extern int audio_samples;               // Samples per callback of the device
+extern int mute;                        // No sound in the window
+
+int open_audio(CH *);                   // Hang a beeper playing on the default SDL device off an instance. -1 if there is no device
+int open_wav(CH *, const char *);       // The same writing a WAV file. -1 if the file can't be written
+void write_wav(CH *);                   // Write the file up to where the machine is
+void hush_audio(CH *);                  // Turn the sound off where the machine is, while it isn't running. The next tick turns it back on
+void close_audio(CH *);                 // Stop the device or finish the file, and detach
+void fill_audio(AUDIO *, int16_t *, int); // Make that many samples from the edges that have come. The sink's side
+
+
+static inline void post_edge(AUDIO *A, unsigned long long ticks, unsigned int tick, unsigned int ipf, int on) // Turn the sound on or off at instruction tick of a 60 Hz tick
+{
+    unsigned int tail = atomic_load_explicit(&A->tail, memory_order_relaxed);
+
+    if(tail - atomic_load_explicit(&A->head, memory_order_acquire) == AUDIOQ){
+        A->dropped++;
+        return;
+    }
+    A->ring[tail % AUDIOQ] = ((ticks * ipf + tick) * A->rate / (60ULL * ipf)) << 1 | (on != 0);
+    atomic_store_explicit(&A->tail, tail + 1, memory_order_release);
+    A->on = on;
+}
+
+static inline void sound_edge(AUDIO *A, const CH *C8) // After the sound timer was set or ticked: post an edge if the sound changed
+{
+    if((C8->sound_timer > 0) != A->on)
+        post_edge(A, A->ticks, C8->tick, C8->ipf, !A->on);
+}
+
+
+#endif // AUDIO_H_INCLUDED
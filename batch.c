@@ -0,0 +1,318 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include "chip8.h"
+#include "pack.h"
+#include "block.h"
+#include "batch.h"
+
+typedef struct Worker                   // begin worker struct
+{
+
+    pthread_t thread;
+    pthread_mutex_t lock;               // Guards the queue, taken by the owner and by thieves
+    int *queue;                         // Ring of session indices, the owner takes from the front, thieves from the back
+    int head;
+    int size;
+    unsigned long executed;             // Instructions run by this thread
+    struct Pool *pool;
+
+}WORKER;                                // end worker struct
+
+typedef struct Pool                     // begin pool struct
+{
+
+    SESSION *sessions;
+    int count;
+    WORKER *workers;
+    int nworkers;
+    unsigned long quantum;
+    int blocks;
+    atomic_int unfinished;              // Sessions that still have budget left
+
+}POOL;                                  // end pool struct
+
+static double seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void push(WORKER *w, int s)
+{
+    pthread_mutex_lock(&w->lock);
+    w->queue[(w->head + w->size) % w->pool->count] = s;
+    w->size++;
+    pthread_mutex_unlock(&w->lock);
+}
+
+static int pop(WORKER *w)                                   // Next session of the owner's queue, -1 when empty
+{
+    int s = -1;
+    pthread_mutex_lock(&w->lock);
+    if(w->size > 0)
+    {
+        s = w->queue[w->head];
+        w->head = (w->head + 1) % w->pool->count;
+        w->size--;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return s;
+}
+
+static int steal(WORKER *w)                                 // A session from the back of someone else's queue, -1 when all are empty
+{
+    POOL *P = w->pool;
+    int i, s = -1;
+    WORKER *v;
+
+    for(i = 1; i < P->nworkers && s < 0; i++)
+    {
+        v = &P->workers[(w - P->workers + i) % P->nworkers];
+        pthread_mutex_lock(&v->lock);
+        if(v->size > 0)
+        {
+            v->size--;
+            s = v->queue[(v->head + v->size) % P->count];
+        }
+        pthread_mutex_unlock(&v->lock);
+    }
+    return s;
+}
+
+static void set_keys(CH *C8, unsigned short int keys)
+{
+    int i;
+    for(i = 0; i < KEYNUM; i++)
+        C8->key[i] = (keys >> i) & 1;
+}
+
+static unsigned long run_quantum(POOL *P, SESSION *S)        // Run a session for a quantum, applying its key changes on the exact instruction
+{
+    unsigned long left = P->quantum, n, ran = 0;
+
+    while(left > 0 && S->executed < S->budget)
+    {
+        while(S->next < S->nevents && S->events[S->next].at <= S->executed)
+            set_keys(&S->C8, S->events[S->next++].keys);
+
+        n = left;
+        if(n > S->budget - S->executed)
+            n = S->budget - S->executed;
+        if(S->next < S->nevents && n > S->events[S->next].at - S->executed)
+            n = S->events[S->next].at - S->executed;
+
+        if(P->blocks)
+            run_blocks(&S->C8, n);
+        else
+            run_cycles(&S->C8, n);
+        S->executed += n;
+        ran += n;
+        left -= n;
+    }
+    return ran;
+}
+
+static void *work(void *arg)
+{
+    WORKER *w = arg;
+    POOL *P = w->pool;
+    int s;
+
+    while(atomic_load(&P->unfinished) > 0)
+    {
+        if((s = pop(w)) < 0 && (s = steal(w)) < 0)
+        {
+            sched_yield();                                  // Everything left is being run by other threads
+            continue;
+        }
+        w->executed += run_quantum(P, &P->sessions[s]);
+        if(P->sessions[s].executed < P->sessions[s].budget)
+            push(w, s);
+        else
+            atomic_fetch_sub(&P->unfinished, 1);
+    }
+    return NULL;
+}
+
+unsigned long run_batch(SESSION *sessions, int count, int threads, unsigned long quantum, int blocks)
+{
+    POOL P;
+    int i;
+    unsigned long executed = 0;
+
+    if(count <= 0)
+        return 0;
+    if(threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(threads <= 0)
+        threads = 1;
+    if(threads > count)
+        threads = count;
+
+    P.sessions = sessions;
+    P.count = count;
+    P.nworkers = threads;
+    P.quantum = quantum > 0 ? quantum : QUANTUM;
+    P.blocks = blocks;
+    atomic_init(&P.unfinished, count);
+    P.workers = calloc(threads, sizeof(WORKER));
+    if(P.workers == NULL)
+        return 0;
+
+    for(i = 0; i < threads; i++)
+    {
+        P.workers[i].pool = &P;
+        P.workers[i].queue = malloc(count * sizeof(int));
+        pthread_mutex_init(&P.workers[i].lock, NULL);
+    }
+    for(i = 0; i < count; i++)                              // Deal the sessions out, stealing evens out the rest
+    {
+        if(sessions[i].executed < sessions[i].budget)
+            push(&P.workers[i % threads], i);
+        else
+            atomic_fetch_sub(&P.unfinished, 1);
+    }
+
+    for(i = 1; i < threads; i++)                            // The calling thread is worker 0
+        pthread_create(&P.workers[i].thread, NULL, work, &P.workers[i]);
+    work(&P.workers[0]);
+    for(i = 1; i < threads; i++)
+        pthread_join(P.workers[i].thread, NULL);
+
+    for(i = 0; i < threads; i++)
+    {
+        executed += P.workers[i].executed;
+        pthread_mutex_destroy(&P.workers[i].lock);
+        free(P.workers[i].queue);
+    }
+    free(P.workers);
+    return executed;
+}
+
+int load_recording(char *name, SESSION *S)
+{
+    FILE *f = fopen(name, "r");
+    KEYEVENT e, *grown;
+    unsigned int keys;
+    int size = 0;
+
+    if(f == NULL){
+        printf("Error. Recording %s not found!\n", name);
+        return -1;
+    }
+    while(fscanf(f, "%lu %x", &e.at, &keys) == 2)
+    {
+        if(S->nevents == size)
+        {
+            size = size ? size * 2 : 64;
+            if((grown = realloc(S->events, size * sizeof(KEYEVENT))) == NULL)
+                break;
+            S->events = grown;
+        }
+        e.keys = keys;
+        S->events[S->nevents++] = e;
+    }
+    fclose(f);
+    return 0;
+}
+
+int load_sessions(char *manifest, SESSION **out, unsigned long budget)
+{
+    FILE *f = fopen(manifest, "r");
+    char line[512], game[256], recording[256];
+    SESSION *sessions = NULL, *grown;
+    int count = 0, size = 0, fields;
+
+    if(f == NULL){
+        printf("Error. Manifest %s not found!\n", manifest);
+        return -1;
+    }
+    while(fgets(line, sizeof(line), f) != NULL)
+    {
+        if((fields = sscanf(line, "%255s %255s", game, recording)) < 1 || game[0] == '#')
+            continue;
+        if(count == size)
+        {
+            size = size ? size * 2 : 16;
+            if((grown = realloc(sessions, size * sizeof(SESSION))) == NULL)
+                break;
+            sessions = grown;
+        }
+        memset(&sessions[count], 0, sizeof(SESSION));
+        if(prepare_game(&sessions[count].C8, game) != 0)
+            continue;
+        sessions[count].budget = budget;
+        if(fields == 2 && load_recording(recording, &sessions[count]) != 0)
+        {
+            free(sessions[count].events);
+            continue;
+        }
+        count++;
+    }
+    fclose(f);
+    *out = sessions;
+    return count;
+}
+
+void free_sessions(SESSION *sessions, int count)
+{
+    int i;
+    for(i = 0; i < count; i++)
+    {
+        free_blocks(&sessions[i].C8);
+        free(sessions[i].events);
+    }
+    free(sessions);
+}
+
+int run_batch_file(char *manifest, unsigned long budget, int threads, int blocks)
+{
+    SESSION *sessions;
+    int count = load_sessions(manifest, &sessions, budget);
+    unsigned long executed;
+    double begin, elapsed;
+
+    if(count < 0)
+        return -1;
+
+    begin = seconds();
+    executed = run_batch(sessions, count, threads, QUANTUM, blocks);
+    elapsed = seconds() - begin;
+
+    printf("sessions: %d\n", count);
+    printf("instructions: %lu\n", executed);
+    printf("seconds: %f\n", elapsed);
+    if(elapsed > 0)
+        printf("instructions per second: %.0f\n", executed / elapsed);
+    free_sessions(sessions, count);
+    return 0;
+}
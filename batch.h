@@ -0,0 +1,71 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef BATCH_H_INCLUDED
+#define BATCH_H_INCLUDED
+
+#include "chip8.h"
+
+#define QUANTUM 20000                   // Instructions a session runs before it goes back in a queue
+
+
+/*
+ * Batch engine. Runs many independent sessions, each a game with its own
+ * CH and an optional input recording, on a pool of threads. Every thread
+ * owns a queue of sessions and runs them a quantum at a time, round robin;
+ * a thread whose queue is empty steals from the back of another one.
+ *
+ * The manifest given to load_sessions() has one session per line: the game
+ * and, optionally, a recording. A recording has one key change per line:
+ * the instruction count at which it happens and the 16 key bits in hex,
+ * bit N for key N.
+ */
+
+
+typedef struct Keyevent                 // begin key event struct
+{
+
+    unsigned long at;                   // Instructions executed before the keys change
+    unsigned short int keys;            // Bit N set when key N is down
+
+}KEYEVENT;                              // end key event struct
+
+typedef struct Session                  // begin session struct
+{
+
+    CH C8;
+    KEYEVENT *events;                   // The input recording, NULL when there is none
+    int nevents;
+    int next;                           // Next event to apply
+    unsigned long budget;               // Instructions to run
+    unsigned long executed;             // Instructions run so far
+
+}SESSION;                               // end session struct
+
+
+int load_sessions(char *, SESSION **, unsigned long);     // Prepare every session of a manifest with an instruction budget. Returns how many, or -1
+int load_recording(char *, SESSION *);                    // Add the key changes of a recording file to a session's events. Returns -1 if it can't be read
+void free_sessions(SESSION *, int);
+unsigned long run_batch(SESSION *, int, int, unsigned long, int); // Sessions, count, threads (0 for one per core), quantum, use the block cache. Returns the instructions run
+int run_batch_file(char *, unsigned long, int, int);     // Manifest, budget, threads, use the block cache. Prints the throughput
+
+
+#endif // BATCH_H_INCLUDED
@@ -0,0 +1,338 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+
+/*
+ * Benchmarks of the core, with a main of their own:
+ *
+ *   cc -O2 -o chip8_bench bench.c chip8.c block.c display.c profile.c pack.c trace.c state.c quirks.c -lpthread
+ *   chip8_bench [-n N] [-r R] [-o results.json] [game ...]
+ *
+ * Every microbenchmark is a generated ROM looping over one family of
+ * instructions. The synthetic games mix them the way real ones do, and
+ * any game given on the command line is run as well. Each runs N
+ * instructions (5000000 by default) through the interpreter and through
+ * the block cache, best of R runs (3), from a fresh instance every time.
+ * The results go out as JSON: instructions and frames of ipf instructions
+ * per second and, for what draws, the time of the run over the DXYN in it.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "chip8.h"
+#include "block.h"
+#include "pack.h"
+
+#define BENCHES 64
+#define BUILTINS 24                             // Added by micro() and synthetic(), after the games
+
+typedef struct Rom                              // begin generated rom struct
+{
+
+    unsigned char byte[ROMMAX];
+    int size;
+
+}ROM;                                           // end generated rom struct
+
+typedef struct Bench                            // begin benchmark struct
+{
+
+    char name[64];
+    const char *kind;                           // "micro", "synthetic" or "game"
+    char path[256];                             // Where the game is, empty for a generated one
+    ROM rom;                                    // The generated game
+
+}BENCH;                                         // end benchmark struct
+
+static BENCH bench[BENCHES];
+static int benches = 0;
+
+static double seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned short int here(ROM *R)          // Address of the next instruction
+{
+    return 0x200 + R->size;
+}
+
+static void op(ROM *R, unsigned short int opcode)
+{
+    R->byte[R->size++] = opcode >> 8;
+    R->byte[R->size++] = opcode & 0xFF;
+}
+
+static void add(const char *name, const char *kind, ROM *R)
+{
+    BENCH *b;
+
+    if(benches >= BENCHES)
+        return;
+    b = &bench[benches++];
+    snprintf(b->name, sizeof(b->name), "%s", name);
+    b->kind = kind;
+    b->path[0] = 0;
+    b->rom = *R;
+}
+
+static int load(CH *C8, BENCH *b)               // Fresh instance of a benchmark's game
+{
+    if(b->path[0] != 0)
+        return prepare_game(C8, b->path);
+    return load_game(C8, b->rom.byte, b->rom.size, NULL);
+}
+
+static void micro()
+{
+    ROM R;
+    unsigned short int loop, sub, sprite;
+    char name[32];
+    int n, i;
+
+    memset(&R, 0, sizeof(R));                   // ALU: every 8XYN
+    loop = here(&R);
+    op(&R, 0x8014); op(&R, 0x8125); op(&R, 0x8236); op(&R, 0x8347); op(&R, 0x8450); op(&R, 0x8561);
+    op(&R, 0x8672); op(&R, 0x8783); op(&R, 0x8017); op(&R, 0x812E); op(&R, 0x8231); op(&R, 0x8306);
+    op(&R, 0x1000 | loop);
+    add("alu_8xyn", "micro", &R);
+
+    memset(&R, 0, sizeof(R));                   // Skips, half of them taken
+    loop = here(&R);
+    op(&R, 0x3000); op(&R, 0x6101); op(&R, 0x4000); op(&R, 0x6201); op(&R, 0x5010); op(&R, 0x6301);
+    op(&R, 0x9010); op(&R, 0x6401); op(&R, 0x3155); op(&R, 0x7101); op(&R, 0x4155); op(&R, 0x7201);
+    op(&R, 0x1000 | loop);
+    add("skip_3x_4x_5x_9x", "micro", &R);
+
+    memset(&R, 0, sizeof(R));                   // Calls and returns
+    loop = here(&R);
+    sub = loop + 6;
+    op(&R, 0x2000 | sub); op(&R, 0x2000 | sub); op(&R, 0x1000 | loop);
+    op(&R, 0x7001); op(&R, 0x00EE);
+    add("call_2nnn_00ee", "micro", &R);
+
+    for(n = 1; n <= 15; n++)                    // DXYN of every height, moving over the screen
+    {
+        memset(&R, 0, sizeof(R));
+        sprite = 0x200 + 2 * 6;
+        op(&R, 0xA000 | sprite);
+        loop = here(&R);
+        op(&R, 0xD010 | n); op(&R, 0x7003); op(&R, 0x7105); op(&R, 0x1000 | loop);
+        op(&R, 0x0000);
+        for(i = 0; i < n; i++)
+            R.byte[R.size++] = 0xA5 ^ (i * 0x3C);
+        snprintf(name, sizeof(name), "draw_dxy%x", n);
+        add(name, "micro", &R);
+    }
+
+    memset(&R, 0, sizeof(R));                   // FX55 and FX65 of all 16 registers
+    op(&R, 0x6F0F);
+    loop = here(&R);
+    op(&R, 0xA400); op(&R, 0xFF55); op(&R, 0xA400); op(&R, 0xFF65); op(&R, 0x1000 | loop);
+    add("copy_fx55_fx65", "micro", &R);
+
+    memset(&R, 0, sizeof(R));                   // FX33
+    loop = here(&R);
+    op(&R, 0xA400); op(&R, 0xF033); op(&R, 0x7001); op(&R, 0x1000 | loop);
+    add("bcd_fx33", "micro", &R);
+}
+
+static void synthetic()
+{
+    ROM R;
+    unsigned short int loop, inner, sub[8];
+    int i;
+
+    memset(&R, 0, sizeof(R));                   // Draw-heavy: clear, then digits at random places
+    loop = here(&R);
+    op(&R, 0x00E0);
+    for(i = 0; i < 8; i++){
+        op(&R, 0xC03F); op(&R, 0xC11F); op(&R, 0xC20F); op(&R, 0xF229); op(&R, 0xD015);
+    }
+    op(&R, 0x1000 | loop);
+    add("draw_heavy", "synthetic", &R);
+
+    memset(&R, 0, sizeof(R));                   // Branch-heavy: a counting loop full of compares
+    loop = here(&R);
+    op(&R, 0x6100);
+    inner = here(&R);
+    op(&R, 0x7101); op(&R, 0x8310); op(&R, 0x8332);
+    op(&R, 0x3300); op(&R, 0x7201); op(&R, 0x4107); op(&R, 0x7401);
+    op(&R, 0x5120); op(&R, 0x7501); op(&R, 0x9130); op(&R, 0x7601);
+    op(&R, 0x31FF); op(&R, 0x1000 | inner);
+    op(&R, 0x1000 | loop);
+    add("branch_heavy", "synthetic", &R);
+
+    memset(&R, 0, sizeof(R));                   // Call-heavy: calls eight deep
+    loop = here(&R);
+    for(i = 0; i < 8; i++)
+        sub[i] = loop + 4 + 6 * i;
+    op(&R, 0x2000 | sub[0]); op(&R, 0x1000 | loop);
+    for(i = 0; i < 8; i++){
+        op(&R, 0x7001);
+        op(&R, i < 7 ? 0x2000 | sub[i + 1] : 0x7101);
+        op(&R, 0x00EE);
+    }
+    add("call_heavy", "synthetic", &R);
+
+    memset(&R, 0, sizeof(R));                   // Timer-bound: draw, then wait out the delay timer
+    loop = here(&R);
+    op(&R, 0x6003); op(&R, 0xF015);
+    inner = here(&R);
+    op(&R, 0xF107); op(&R, 0x3100); op(&R, 0x1000 | inner);
+    op(&R, 0x7201); op(&R, 0xF229); op(&R, 0xD235); op(&R, 0x1000 | loop);
+    add("timer_wait", "synthetic", &R);
+}
+
+static unsigned long count_dxyn(BENCH *b, unsigned long n)   // DXYN among the first n instructions, one step at a time
+{
+    CH *C8 = malloc(sizeof(CH));
+    unsigned long count = 0;
+    const INSN *in;
+
+    if(C8 == NULL || load(C8, b) != 0){
+        free(C8);
+        return 0;
+    }
+    seed_random(C8, 1);
+    while(n-- > 0)
+    {
+        in = &C8->decoded[C8->pc & 0xFFF];
+        if(in->op == OP_DECODE){
+            decode_insn(C8, C8->pc & 0xFFF);
+            in = &C8->decoded[C8->pc & 0xFFF];
+        }
+        if(in->op == OP_DXYN)
+            count++;
+        cycles(C8);
+    }
+    free(C8);
+    return count;
+}
+
+static double measure(BENCH *b, unsigned long n, int blocks, int runs)   // Best time of the runs, in seconds. -1 if the game can't be loaded
+{
+    CH *C8 = malloc(sizeof(CH));
+    double best = -1, begin, elapsed;
+    int r;
+
+    if(C8 == NULL)
+        return -1;
+    for(r = 0; r < runs; r++)
+    {
+        if(load(C8, b) != 0)
+            break;
+        seed_random(C8, 1);
+        begin = seconds();
+        if(blocks)
+            run_blocks(C8, n);
+        else
+            run_cycles(C8, n);
+        elapsed = seconds() - begin;
+        free_blocks(C8);
+        if(best < 0 || elapsed < best)
+            best = elapsed;
+    }
+    free(C8);
+    return best;
+}
+
+static void json_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for(; *s; s++)
+    {
+        if(*s == '"' || *s == '\\')
+            fputc('\\', out);
+        if((unsigned char)*s < 0x20)
+            fprintf(out, "\\u%04x", *s);
+        else
+            fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long n = 5000000, dxyn;
+    int runs = 3, i, b, blocks, first = 1;
+    double t;
+    FILE *out = stdout;
+
+    for(i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            n = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+            runs = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc){
+            if((out = fopen(argv[++i], "w")) == NULL){
+                fprintf(stderr, "Can't write %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if(benches >= BENCHES - BUILTINS)
+            fprintf(stderr, "%s: only %d games, skipped\n", argv[i], BENCHES - BUILTINS);
+        else
+        {
+            snprintf(bench[benches].name, sizeof(bench[benches].name), "%s", basename_of(argv[i]));
+            snprintf(bench[benches].path, sizeof(bench[benches].path), "%s", argv[i]);
+            bench[benches].kind = "game";
+            benches++;
+        }
+    }
+    if(runs < 1)
+        runs = 1;
+
+    micro();
+    synthetic();
+
+    fprintf(out, "{\n  \"instructions\": %lu,\n  \"runs\": %d,\n  \"ipf\": %u,\n  \"results\": [", n, runs, ipf);
+    for(b = 0; b < benches; b++)
+    {
+        dxyn = count_dxyn(&bench[b], n);
+        for(blocks = 0; blocks <= 1; blocks++)
+        {
+            if((t = measure(&bench[b], n, blocks, runs)) < 0)
+                continue;
+            if(t <= 0)
+                t = 1e-9;
+            fprintf(out, "%s\n    {\"name\": ", first ? "" : ",");
+            json_string(out, bench[b].name);
+            fprintf(out, ", \"kind\": \"%s\", \"engine\": \"%s\", \"seconds\": %.6f, \"instructions_per_second\": %.0f, \"frames_per_second\": %.0f",
+                    bench[b].kind, blocks ? "blocks" : "cycles", t, n / t, n / t / ipf);
+            if(dxyn > 0)
+                fprintf(out, ", \"dxyn\": %lu, \"ns_per_dxyn\": %.2f", dxyn, t * 1e9 / dxyn);
+            fprintf(out, "}");
+            first = 0;
+            fprintf(stderr, "%-20s %-7s %12.0f instructions/s\n", bench[b].name, blocks ? "blocks" : "cycles", n / t);
+        }
+    }
+    fprintf(out, "\n  ]\n}\n");
+    if(out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,249 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+#include "block.h"
+
+static int ends_block(unsigned char op)                     // Instructions after which the next PC isn't the next address, or the code may have changed
+{
+    switch(op)
+    {
+        case OP_UNKNOWN: case OP_00EE: case OP_1NNN: case OP_2NNN:
+        case OP_3XNN: case OP_4XNN: case OP_5XY0: case OP_9XY0:
+        case OP_BNNN: case OP_DXYN: case OP_EX9E: case OP_EXA1:
+        case OP_FX0A: case OP_FX33: case OP_FX55: case OP_5XY2:
+        case OP_00FD: case OP_BXNN: case OP_FX55_I:
+            return 1;
+    }
+    return 0;
+}
+
+static int uses_timers(unsigned char op)
+{
+    return op == OP_FX07 || op == OP_WAIT || op == OP_FX15 || op == OP_FX18;
+}
+
+static void flush(BLOCKS *B)
+{
+    memset(B->map, 0, sizeof(B->map));
+    memset(B->covered, 0, sizeof(B->covered));
+    B->nblocks = 0;
+    B->ncode = 0;
+}
+
+static int fuse(INSN *code, int n)                          // Merge loads and adds of the same register, and loads of I, that follow each other. Returns the instructions left
+{
+    INSN *prev;
+    int i, w = 0;
+
+    for(i = 0; i < n - 1; i++)                              // The last one leaves the block, it stays as it is
+    {
+        prev = w > 0 ? &code[w - 1] : NULL;
+        if(prev != NULL && (prev->op == OP_6XNN || prev->op == OP_7XNN) && prev->x == code[i].x && code[i].op == OP_7XNN)
+            prev->nn += code[i].nn;                         // One add, or one load of the sum
+        else if(prev != NULL && (((prev->op == OP_6XNN || prev->op == OP_7XNN) && prev->x == code[i].x && code[i].op == OP_6XNN) || (prev->op == OP_ANNN && code[i].op == OP_ANNN)))
+            *prev = code[i];                                // The second load undoes the first
+        else
+            code[w++] = code[i];
+    }
+    code[w++] = code[n - 1];
+    return w;
+}
+
+/*
+ * The instructions inside a block, but the last, run from handlers of
+ * their own that leave the PC alone: it is set once for the whole block.
+ * The pointers are looked up when the block is translated. What isn't
+ * here runs its usual handler, whose PC update doesn't matter.
+ */
+
+static void body_6XNN(CH *C8, const INSN *in) { C8->V[in->x] = in->nn; }
+static void body_7XNN(CH *C8, const INSN *in) { C8->V[in->x] += in->nn; }
+static void body_8XY0(CH *C8, const INSN *in) { C8->V[in->x] = C8->V[in->y]; }
+static void body_8XY1(CH *C8, const INSN *in) { C8->V[in->x] |= C8->V[in->y]; }
+static void body_8XY2(CH *C8, const INSN *in) { C8->V[in->x] &= C8->V[in->y]; }
+static void body_8XY3(CH *C8, const INSN *in) { C8->V[in->x] ^= C8->V[in->y]; }
+static void body_ANNN(CH *C8, const INSN *in) { C8->I = in->opcode & 0x0FFF; }
+static void body_FX07(CH *C8, const INSN *in) { C8->V[in->x] = C8->delay_timer; }
+static void body_FX15(CH *C8, const INSN *in) { C8->delay_timer = C8->V[in->x]; }
+
+static void body_8XY4(CH *C8, const INSN *in)
+{
+    C8->V[0xF] = C8->V[in->y] > (0xFF - C8->V[in->x]);
+    C8->V[in->x] += C8->V[in->y];
+}
+
+static void body_8XY5(CH *C8, const INSN *in)
+{
+    C8->V[0xF] = C8->V[in->y] <= C8->V[in->x];
+    C8->V[in->x] -= C8->V[in->y];
+}
+
+static void body_8XY7(CH *C8, const INSN *in)
+{
+    C8->V[0xF] = C8->V[in->x] <= C8->V[in->y];
+    C8->V[in->x] = C8->V[in->y] - C8->V[in->x];
+}
+
+static void body_8XY6(CH *C8, const INSN *in)
+{
+    unsigned char v;
+    C8->V[0xF] = C8->V[in->x] & 0x1;
+    v = C8->V[in->x];
+    C8->V[in->x] = v >> 1;
+}
+
+static void body_8XYE(CH *C8, const INSN *in)
+{
+    unsigned char v;
+    C8->V[0xF] = C8->V[in->x] >> 7;
+    v = C8->V[in->x];
+    C8->V[in->x] = v << 1;
+}
+
+static void (*const body[OPS])(CH *, const INSN *) =
+{
+    [OP_6XNN] = body_6XNN, [OP_7XNN] = body_7XNN, [OP_8XY0] = body_8XY0, [OP_8XY1] = body_8XY1,
+    [OP_8XY2] = body_8XY2, [OP_8XY3] = body_8XY3, [OP_8XY4] = body_8XY4, [OP_8XY5] = body_8XY5,
+    [OP_8XY6] = body_8XY6, [OP_8XY7] = body_8XY7, [OP_8XYE] = body_8XYE, [OP_ANNN] = body_ANNN,
+    [OP_FX07] = body_FX07, [OP_FX15] = body_FX15,
+};
+
+static BLOCK *translate(CH *C8, BLOCKS *B, unsigned short int pc)
+{
+    BLOCK *b;
+    INSN *in;
+    unsigned short int addr = pc;
+
+    if(B->nblocks == BLOCKPOOL || B->ncode + BLOCKMAX > BLOCKPOOL)
+        flush(B);
+
+    b = &B->block[B->nblocks];
+    b->start = pc;
+    b->first = B->ncode;
+    b->count = 0;
+    b->timers = 0;
+
+    for(;;)
+    {
+        if(C8->decoded[addr].op == OP_DECODE)
+            decode_insn(C8, addr);
+        in = &B->code[b->first + b->count];
+        *in = C8->decoded[addr];
+        b->count++;
+        B->covered[addr] = 1;
+        B->covered[(addr + 1) & 0xFFF] = 1;
+        if(uses_timers(in->op))
+            b->timers = 1;
+        if(ends_block(in->op) || b->count == BLOCKMAX || addr + 2 > 0xFFE)
+            break;
+        addr += 2;
+    }
+
+    b->idle = B->code[b->first].op == OP_WAIT || B->code[b->first].op == OP_FX0A; // skip_idle() checks again that it still is one
+    b->ops = fuse(&B->code[b->first], b->count);
+    for(in = &B->code[b->first]; in < &B->code[b->first + b->ops - 1]; in++)
+        B->run[in - B->code] = body[in->op] != NULL ? body[in->op] : handlers[in->op];
+    B->ncode += b->ops;
+    B->map[pc] = ++B->nblocks;
+    return b;
+}
+
+void run_blocks(CH *C8, unsigned long n)
+{
+    BLOCKS *B = C8->blocks;
+    BLOCK *b;
+    const INSN *in, *last;
+    void (*const *run)(CH *, const INSN *);
+    unsigned short int pc;
+    unsigned long idle;
+
+    if(C8->profile != NULL || C8->trace != NULL || (B == NULL && (B = C8->blocks = calloc(1, sizeof(BLOCKS))) == NULL)){ // The profiler and the trace see instructions one by one
+        run_cycles(C8, n);
+        return;
+    }
+
+    while(n > 0)
+    {
+        pc = C8->pc & 0xFFF;
+        if(B->map[pc] != 0)
+            b = &B->block[B->map[pc] - 1];
+        else
+            b = translate(C8, B, pc);
+        if(b->idle && (idle = skip_idle(C8, n)) > 0){       // Waiting on the delay timer or a key
+            n -= idle;
+            continue;
+        }
+
+        if(b->count > n){                                   // Not enough budget left for the whole block
+            run_cycles(C8, n);
+            return;
+        }
+        n -= b->count;
+        if(b->timers && C8->tick + b->count > C8->ipf){     // The timers tick inside a block that reads or sets them: one instruction at a time
+            run_cycles(C8, b->count);
+            continue;
+        }
+
+        in = &B->code[b->first];                            // Otherwise they read the same all through the block, and catch up once at its end
+        last = in + b->ops - 1;
+        pc = C8->pc;
+        for(run = &B->run[b->first]; in < last; in++, run++)
+            (*run)(C8, in);
+        C8->pc = pc + 2 * (b->count - 1);
+        C8->opcode = last->opcode;
+        handlers[last->op](C8, last);
+        if(C8->tick + b->count < C8->ipf)
+            C8->tick += b->count;
+        else
+            pass_cycles(C8, b->count);
+    }
+}
+
+void invalidate_blocks(BLOCKS *B, unsigned short int addr, int len)
+{
+    int i, s, hit = 0;
+    BLOCK *b;
+
+    for(i = 0; i < len; i++)
+        hit |= B->covered[(addr + i) & 0xFFF];
+    if(!hit)                                                // Data, not code: nothing to drop
+        return;
+
+    for(i = -2 * BLOCKMAX + 1; i < len; i++)                // Any block that can reach addr starts at most BLOCKMAX instructions before it
+    {
+        s = (addr + i) & 0xFFF;
+        if(B->map[s] == 0)
+            continue;
+        b = &B->block[B->map[s] - 1];
+        if(b->start + 2 * b->count > addr && b->start < addr + len)
+            B->map[s] = 0;
+    }
+}
+
+void free_blocks(CH *C8)
+{
+    free(C8->blocks);
+    C8->blocks = NULL;
+}
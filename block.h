@@ -0,0 +1,81 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef BLOCK_H_INCLUDED
+#define BLOCK_H_INCLUDED
+
+#include "chip8.h"
+
+#define BLOCKMAX 32                     // Longest block, in instructions
+#define BLOCKPOOL 4096                  // Instructions the cache holds before it is flushed
+
+
+/*
+ * Basic block cache. A block is the straight-line code starting at some
+ * PC up to and including the first instruction that can leave it: a
+ * jump, call, return, skip, draw, key wait, memory store or unknown
+ * opcode. Blocks are copied out of the instruction cache once, with
+ * loads and adds of the same register that follow each other fused into
+ * one, and every instruction but the last bound to a handler that leaves
+ * the PC alone. A block runs with no fetch, sets the PC once and brings
+ * the timers up to date once at its end; one that reads or sets a timer
+ * and would see it tick halfway goes through run_cycles() instead.
+ *
+ * It is experimental. It beats run_cycles() on long runs of ALU code, by
+ * up to a third, but games branch every few instructions and on blocks
+ * that short its bookkeeping costs more than the fetches it saves: skip,
+ * call and small draw loops run at half to three quarters of the speed
+ * of run_cycles(). An order of magnitude would take native code.
+ */
+
+
+typedef struct Block                    // begin block struct
+{
+
+    unsigned short int start;           // Address of the first instruction
+    unsigned short int first;           // Index of the first instruction in code[]
+    unsigned char count;                // Number of instructions
+    unsigned char ops;                  // Entries of code[] they were fused into, the last one unchanged
+    unsigned char timers;               // Set when an instruction of the block touches a timer
+    unsigned char idle;                 // Set when it starts with an idle wait, FX0A or OP_WAIT
+
+}BLOCK;                                 // end block struct
+
+typedef struct Blocks                   // begin block cache struct
+{
+
+    unsigned short int map[MEMOSZ];     // Block starting at each address, as an index in block[] plus one, 0 when there is none
+    unsigned char covered[MEMOSZ];      // Set for every byte a cached block was built from
+    BLOCK block[BLOCKPOOL];
+    INSN code[BLOCKPOOL];               // The instructions of every block, one after another
+    void (*run[BLOCKPOOL])(CH *, const INSN *); // The handler each of them but the last of a block runs with
+    int nblocks;                        // Blocks in use
+    int ncode;                          // Instructions in use
+
+}BLOCKS;                                // end block cache struct
+
+
+void run_blocks(CH *, unsigned long);                     // Run that many cycles through the block cache, same result as run_cycles()
+void invalidate_blocks(BLOCKS *, unsigned short int, int); // Memory at an address was written, drop the blocks built from it
+void free_blocks(CH *);                                   // Release the block cache, needed before preparing the emulator again
+
+
+#endif // BLOCK_H_INCLUDED
@@ -25,19 +25,19 @@
 #include <string.h>
 #include <time.h>
 #include "chip8.h"
+#include "block.h"
+#include "display.h"
+#include "profile.h"
+#include "trace.h"
+#include "audio.h"
+#include "quirks.h"
 
 #define FONTNUM 80
-#define SCREEN_WIDTH 640                                // Width of the window
-#define SCREEN_HEIGHT 320                               // Height of the window
-#define SCREEN_BPP 32                                   // Bits per pixel
-#define W 64                                            // Width of the emulator screen
-#define H 32                                            // Height of the emulator screen
+#define BIGFONT FONTNUM                                 // Where the 8x10 font starts, right after the small one
+#define BIGFONTNUM 160
 #define MEMORYBEGIN 0x200                               // Location to being the counter
 
-SDL_Window *window = NULL;
-SDL_Surface *surface = NULL;
-int color = 1;                                          // Used as a flag to see if the emulator shall or not draw on the screen
-int scale = 10;                                         // The size of each rectangle
+unsigned int ipf = IPF;
 
 unsigned char ch_font[FONTNUM] =                        // Font set
 {
@@ -59,18 +59,90 @@ unsigned char ch_font[FONTNUM] =                        // Font set
   0xF0, 0x80, 0xF0, 0x80, 0x80                          // F
 };
 
-void prepare_emulator(CH *C8, char *name)
+unsigned char big_font[BIGFONTNUM] =                    // Font set of FX30, 8x10
+{
+  0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+  0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+  0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+  0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+  0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+  0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+  0x3E, 0x7C, 0xE0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+  0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+  0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+  0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C, // 9
+  0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+  0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+  0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+  0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+  0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+  0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+int prepare_emulator(CH *C8, char *name)
+{
+    unsigned char buffer[ROMMAX];
+    FILE *rom;
+    long romSize;
+
+    rom = fopen(name, "rb");                              // Open ROM
+
+    if(rom == NULL){
+        printf("Error. Game not found!\n");
+        return -1;
+    }
+
+    fseek(rom, 0L, SEEK_END);                             // Get size of ROM
+    romSize = ftell(rom);
+    rewind(rom);
+
+    if(romSize < 0 || romSize > ROMMAX){                  // Has to fit between 0x200 and the end of memory
+        printf("Error. Game too big!\n");
+        fclose(rom);
+        return -1;
+    }
+    if(fread(buffer, 1, romSize, rom) != (size_t)romSize){
+        printf("Error. Game can't be read!\n");
+        fclose(rom);
+        return -1;
+    }
+    fclose(rom);
+
+    return load_game(C8, buffer, romSize, NULL);
+}
+
+int load_game(CH *C8, const unsigned char *game, size_t size, const INSN *decoded)
+{
+    return boot_game(C8, game, size, decoded, ipf > 0 ? ipf : IPF, game_quirks(game, size));
+}
+
+int boot_game(CH *C8, const unsigned char *game, size_t size, const INSN *decoded, unsigned int rate, unsigned char q)
 {
     int i;
+
+    if(size > ROMMAX)
+        return -1;
+
     C8->pc = MEMORYBEGIN;                                 // The system expects the application to load at memory location 0x200
     C8->ps = 0;                                           // Reset pointer to the stack
     C8->opcode = 0;                                       // Reset opcode
     C8->I = 0;                                            // Reset index register
     C8->delay_timer = 0;
     C8->sound_timer = 0;
-
-    for(i = 0; i < MEMOSZ; i++)                           // Reset memory
-        C8->memory[i] = 0;
+    C8->ipf = rate;
+    C8->tick = 0;
+    C8->draw = 1;                                         // Used as a flag to see if the emulator shall or not draw on the screen
+    C8->hires = 0;                                        // 64x32, drawing to the first plane
+    C8->planes = 1;
+    C8->quirks = q;                                       // Before decoding, which goes by them
+    C8->unknown = 0;
+    C8->blocks = NULL;                                    // Built by run_blocks() when it's used. These four leak if loaded over, unload_game() first
+    C8->profile = NULL;
+    C8->trace = NULL;
+    C8->audio = NULL;
+    C8->base = NULL;                                      // Not saved anywhere yet
+    C8->stamp = 0;
+    C8->dirty = 0;
 
     for(i = 0; i < STACKS; i++)                           // Reset stack
         C8->stack[i] = 0;
@@ -78,398 +150,919 @@ void prepare_emulator(CH *C8, char *name)
     for(i = 0; i < KEYNUM; i++)                           // Reset button
         C8->key[i] = 0;
 
-    for(i = 0; i < REGISTER; i++)                         // Reset register
+    for(i = 0; i < REGISTER; i++){                        // Reset register
         C8->V[i] = 0;
+        C8->flags[i] = 0;
+    }
 
-    for(i = 0; i < GRAPHICS; i++)                         // Reset graphics
-        C8->graphics[i] = 0;
+    for(i = 0; i < PLANES; i++)                           // Reset graphics
+        clear_graphics(C8->graphics[i][0], HIRES_H);
 
-    for(i = 0; i < FONTNUM; i++)                          // Load the font set into the memory of the Chip-8
-        C8->memory[i] = ch_font[i];
+    memcpy(C8->memory, ch_font, FONTNUM);                 // The font sets, then the game at 0x200, zeros everywhere else
+    memcpy(C8->memory + BIGFONT, big_font, BIGFONTNUM);
+    memset(C8->memory + BIGFONT + BIGFONTNUM, 0, MEMORYBEGIN - BIGFONT - BIGFONTNUM);
+    memcpy(C8->memory + MEMORYBEGIN, game, size);
+    memset(C8->memory + MEMORYBEGIN + size, 0, ROMMAX - size);
 
-    C8->rom = fopen(name, "rb");                          // Open ROM
+    if(decoded != NULL)                                   // Fill the instruction cache with the font and the game
+        memcpy(C8->decoded, decoded, sizeof(C8->decoded));
+    else
+        decode_memory(C8);
+    seed_random(C8, time(NULL));                          // Seed necessary for a single instruction
+    return 0;
+}
 
-    if(C8->rom == NULL){
-        printf("Error. Game not found!");
-        fclose(C8->rom);
-        return;
-    }
+void unload_game(CH *C8)
+{
+    free_blocks(C8);
+    stop_profile(C8);
+    stop_trace(C8);                                         // Joins its writer thread
+}
 
-    fseek(C8->rom, 0L, SEEK_END);                           // Get size of ROM
-    int romSize = ftell(C8->rom);                           // Set romSize to the size of ROM
-    rewind(C8->rom);
+void seed_random(CH *C8, uint32_t seed)
+{
+    C8->random = seed != 0 ? seed : 0x2545F491;             // Xorshift never leaves 0, so 0 can't be a seed
+}
 
-    unsigned char *buffer = malloc(romSize);                // Create a pointer to a memory with the size of the ROM
-    fread(buffer, romSize, 1, C8->rom);                     // Read the ROM into the pointer
-    fclose(C8->rom);
+uint32_t next_random(CH *C8)                                // Xorshift32, each instance has its own so they can run side by side
+{
+    uint32_t r = C8->random;
+    r ^= r << 13;
+    r ^= r >> 17;
+    r ^= r << 5;
+    return C8->random = r;
+}
 
-    for(i = 0; i <= romSize; i++)                           // Load the ROM into the memory starting at 0x200 + i
-        C8->memory[i+MEMORYBEGIN] = buffer[i];
+/*
+ * Decoder. Every address of the memory has a predecoded instruction: the
+ * handler to run and its operands already pulled out of the opcode, so
+ * cycles() never fetches or masks anything. The cache is filled when the
+ * game is loaded, and FX33/FX55 mark what they overwrite as OP_DECODE so it
+ * is decoded again the next time it runs.
+ */
 
-    free(buffer);
-    srand(time(NULL));                                      // Srand necessary for a single instruction
+static unsigned short int word(CH *C8, unsigned short int addr)
+{
+    return C8->memory[addr & 0xFFF] << 8 | C8->memory[(addr + 1) & 0xFFF];
 }
 
-void cycles(CH *C8)
+static int timer_loop(CH *C8, unsigned short int addr)      // 1 when addr heads "FX07, skip on VX, jump back to addr", 2 for "FX07, skip on VX, jump out, jump back to addr", 0 otherwise
+{
+    unsigned short int read = word(C8, addr), skip = word(C8, addr + 2);
+
+    if((read & 0xF0FF) != 0xF007 || (skip & 0x0F00) != (read & 0x0F00))
+        return 0;
+    if((skip & 0xF000) != 0x3000 && (skip & 0xF000) != 0x4000)
+        return 0;
+    if(word(C8, addr + 4) == (0x1000 | addr))
+        return 1;
+    if((word(C8, addr + 4) & 0xF000) == 0x1000 && word(C8, addr + 6) == (0x1000 | addr))
+        return 2;
+    return 0;
+}
+
+void decode_insn(CH *C8, unsigned short int addr)
 {
-    int i, pressed;
-    unsigned short int vx, vy;
-    C8->opcode = C8->memory[C8->pc] << 8 | C8->memory[C8->pc + 1]; // Must merge both bytes as they are 1 byte long and must be 2 bytes long
-    switch(C8->opcode & 0xF000){
+    INSN *in = &C8->decoded[addr];
+    unsigned short int opcode = C8->memory[addr] << 8 | C8->memory[(addr + 1) & 0xFFF];
+
+    in->opcode = opcode;
+    in->x = (opcode & 0x0F00) >> 8;
+    in->y = (opcode & 0x00F0) >> 4;
+    in->nn = opcode & 0x00FF;
+    in->op = OP_UNKNOWN;
+
+    switch(opcode & 0xF000){
         case 0x0000:
-            switch(C8->opcode & 0x00FF)
+            switch(opcode & 0x00FF)
             {
-            case 0x00E0:                                     // 00E0: Clears the screen
-                    for(i = 0; i < GRAPHICS; i++)
-                        C8->graphics[i] = 0x0;
-                    color = 1;
-                    C8->pc += 2;
-                break;
-                case 0x00EE:                                     // 00EE: Returns from a subroutine
-                    C8->ps--;                                 // Decrease stack pointer to avoid overwriting
-                    C8->pc = C8->stack[C8->ps];                  // Put the address into the program counter
-                    C8->pc += 2;
-                break;
+                case 0x00E0: in->op = OP_00E0; break;
+                case 0x00EE: in->op = OP_00EE; break;
+                case 0x00FB: in->op = OP_00FB; break;
+                case 0x00FC: in->op = OP_00FC; break;
+                case 0x00FD: in->op = OP_00FD; break;
+                case 0x00FE: in->op = OP_00FE; break;
+                case 0x00FF: in->op = OP_00FF; break;
                 default:
-                    printf("Unknow opcode: 0x%x\n", C8->opcode);
+                    if((opcode & 0x00F0) == 0x00C0)
+                        in->op = OP_00CN;
+                    else if((opcode & 0x00F0) == 0x00D0)
+                        in->op = OP_00DN;
             }
         break;
-        case 0x1000:                                              // 1NNN: Jumps to address NNN
-            C8->pc = C8->opcode & 0x0FFF;
-        break;
-        case 0x2000:                                              // 2NNN: Calls subroutine at NNN
-            C8->stack[C8->ps] = C8->pc;                           // Store address on pointer stack
-            C8->ps++;                                             // Increase stack pointer to avoid overwriting
-            C8->pc = C8->opcode & 0x0FFF;                         // Set program counter to the address at NNN
-        break;
-        case 0x3000:                                              // 3XNN: Skips the next instruction if VX equals NN
-            if((C8->V[(C8->opcode & 0x0F00) >> 8]) == (C8->opcode & 0x00FF))
-                C8->pc += 4;
-            else
-                C8->pc += 2;
-        break;
-        case 0x4000:                                              // 4XNN: Skips the next instruction if VX doesn't equal NN
-            if((C8->V[(C8->opcode & 0x0F00) >> 8]) != (C8->opcode & 0x00FF))
-                C8->pc += 4;
-            else
-                C8->pc += 2;
-        break;
-        case 0x5000:                                              // 5XYO: Skips the next instruction if VX equals VY
-            if((C8->V[(C8->opcode & 0x0F00) >> 8]) == (C8->V[(C8->opcode & 0x00F0) >> 4]))
-                C8->pc += 4;
-            else
-                C8->pc += 2;
-        break;
-        case 0x6000:                                              // 6XNN: Sets VX to NN
-            C8->V[(C8->opcode & 0x0F00) >> 8] = C8->opcode & 0x00FF;
-            C8->pc += 2;
-        break;
-        case 0x7000:                                              // 7XNN: Adds NN to VX
-            C8->V[(C8->opcode & 0x0F00) >> 8] += C8->opcode & 0x00FF;
-            C8->pc += 2;
-        break;
-        case 0x8000:
-            switch(C8->opcode & 0x000F)
+        case 0x1000: in->op = OP_1NNN; break;
+        case 0x2000: in->op = OP_2NNN; break;
+        case 0x3000: in->op = OP_3XNN; break;
+        case 0x4000: in->op = OP_4XNN; break;
+        case 0x5000:
+            switch(opcode & 0x000F)
             {
-                case 0x0000:                                      // 8XY0: Sets VX to the value of VY
-                    C8->V[(C8->opcode & 0x0F00) >> 8] = C8->V[(C8->opcode & 0x00F0) >> 4];
-                    C8->pc += 2;
-                break;
-                case 0x0001:                                      // 8XY1: Sets VX to VX or VY
-                    C8->V[(C8->opcode & 0x0F00) >> 8] |= C8->V[(C8->opcode & 0x00F0) >> 4];
-                    C8->pc += 2;
-                break;
-                case 0x0002:                                      // 8XY2: Sets VX to VX and VY
-                    C8->V[(C8->opcode & 0x0F00) >> 8] &= C8->V[(C8->opcode & 0x00F0) >> 4];
-                    C8->pc += 2;
-                break;
-                case 0x0003:                                      // 8XY3: Sets VX to VX xor VY
-                    C8->V[(C8->opcode & 0x0F00) >> 8] ^= C8->V[(C8->opcode & 0x00F0) >> 4];
-                    C8->pc += 2;
-                break;
-                case 0x0004:                                       // 8XY4: Adds VY to VX. VF is set to 1 when there's a carry, and to 0 when there isn't
-                    if(C8->V[(C8->opcode & 0x00F0) >> 4] > (0xFF - C8->V[(C8->opcode & 0x0F00) >> 8]))
-                        C8->V[0xF] = 1;
-                    else
-                        C8->V[0xF] = 0;
-                    C8->V[(C8->opcode & 0x0F00) >> 8] += C8->V[(C8->opcode & 0x00F0) >> 4];
-                    C8->pc += 2;
-                break;
-                case 0x0005:                                      // 8XY5: VY is subtracted from VX. VF is set to 0 when there's a borrow, and 1 when there isn't
-                    if(C8->V[(C8->opcode & 0x00F0) >> 4] > C8->V[(C8->opcode & 0x0F00) >> 8]) // If VY > VX, there is a borrow
-                        C8->V[0xF] = 0;
-                    else
-                        C8->V[0xF] = 1;
-                    C8->V[(C8->opcode & 0x0F00) >> 8] -= C8->V[(C8->opcode & 0x00F0) >> 4];
-                    C8->pc += 2;
-                break;
-                case 0x0006:                                      // 8XY6: Shifts VX right by one: VF is set to the value of the least significant bit of VX before the shift
-                    C8->V[0xF] = C8->V[(C8->opcode & 0x0F00) >> 8] & 0x1;
-                    C8->V[(C8->opcode & 0x0F00) >> 8] >>=  1;
-                    C8->pc += 2;
-                break;
-                case 0x0007:                                      // 8XY7: Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1 when there isn't
-                    if(C8->V[(C8->opcode & 0x0F00) >> 8] > C8->V[(C8->opcode & 0x00F0) >> 4]) // If VX > VY , there is a borrow
-                        C8->V[0xF] = 0;
-                    else
-                        C8->V[0xF] = 1;
-                    C8->V[(C8->opcode & 0x0F00) >> 8] = C8->V[(C8->opcode & 0x00F0) >> 4] - C8->V[(C8->opcode & 0x0F00) >> 8];
-                    C8->pc += 2;
-                break;
-                case 0x000E:                                      // 8XYE: Shifts VX left by one. VG is set to the value of the most significant bit of VX before the shift
-                    C8->V[0xF] = C8->V[(C8->opcode & 0x0F00) >> 8] >> 7;
-                    C8->V[(C8->opcode & 0x0F00) >> 8] <<= 1;
-                    C8->pc += 2;
-                break;
-                default:
-                    printf("Unknow opcode: 0x%x\n", C8->opcode);
+                case 0x0002: in->op = OP_5XY2; break;
+                case 0x0003: in->op = OP_5XY3; break;
+                default: in->op = OP_5XY0; break;
             }
         break;
-        case 0x9000:                                              // 9XYO: Skips the next instruction if VX doesn't equal VY
-            if(C8->V[(C8->opcode & 0x0F00) >> 8] != C8->V[(C8->opcode & 0x00F0) >> 4])
-                C8->pc += 4;
-            else
-                C8->pc += 2;
-        break;
-        case 0xA000:                                              // ANNN: Sets I to the address NNN
-            C8->I = C8->opcode & 0x0FFF;
-            C8->pc += 2;
-        break;
-        case 0xB000:                                              // BNNN: Jumps to the address NNN plus V0
-            C8->pc = (C8->opcode & 0x0FFF) + C8->V[0x0];
-        break;
-        case 0xC000:                                              // CXNN: Sets VX to a random number and NN
-            C8->V[(C8->opcode & 0x0F00) >> 8] = (rand() % 0xFF) & (C8->opcode & 0x00FF);
-            C8->pc += 2;
-        break;
-        case 0xD000:                                              // DXYN: Sprites stored in memory at location in index register, maximum 8bits wide. Wraps around the screen.
-            vx = C8->V[(C8->opcode & 0x0F00) >> 8];
-            vy = C8->V[(C8->opcode & 0x00F0) >> 4];
-            unsigned short int height = C8->opcode & 0x000F;
-            unsigned short int pixel;
-            int yline;
-            int xline;
-            C8->V[0xF] = 0;
-
-            for(yline = 0; yline < height; yline++){              // If when drawn, clears a pixel, register VF is set to 1 otherwise it is zero. All drawing is XOR drawing.
-                pixel = C8->memory[C8->I + yline];
-                for(xline = 0; xline < 8; xline++){
-                    if((pixel & (0x80 >> xline)) != 0){
-                        if(C8->graphics[vx + xline + ((vy + yline) * 64)] == 1)
-                            C8->V[0xF] = 1;
-                        C8->graphics[vx + xline + ((vy + yline) * 64)] ^= 1;
-                    }
-                }
+        case 0x6000: in->op = OP_6XNN; break;
+        case 0x7000: in->op = OP_7XNN; break;
+        case 0x8000:
+            switch(opcode & 0x000F)
+            {
+                case 0x0000: in->op = OP_8XY0; break;
+                case 0x0001: in->op = C8->quirks & QUIRK_VF_RESET ? OP_8XY1_VF : OP_8XY1; break;
+                case 0x0002: in->op = C8->quirks & QUIRK_VF_RESET ? OP_8XY2_VF : OP_8XY2; break;
+                case 0x0003: in->op = C8->quirks & QUIRK_VF_RESET ? OP_8XY3_VF : OP_8XY3; break;
+                case 0x0004: in->op = OP_8XY4; break;
+                case 0x0005: in->op = OP_8XY5; break;
+                case 0x0006: in->op = C8->quirks & QUIRK_SHIFT_VY ? OP_8XY6_VY : OP_8XY6; break;
+                case 0x0007: in->op = OP_8XY7; break;
+                case 0x000E: in->op = C8->quirks & QUIRK_SHIFT_VY ? OP_8XYE_VY : OP_8XYE; break;
             }
-            color = 1;
-            C8->pc += 2;
         break;
+        case 0x9000: in->op = OP_9XY0; break;
+        case 0xA000: in->op = OP_ANNN; break;
+        case 0xB000: in->op = C8->quirks & QUIRK_JUMP_VX ? OP_BXNN : OP_BNNN; break;
+        case 0xC000: in->op = OP_CXNN; break;
+        case 0xD000: in->op = OP_DXYN; break;
         case 0xE000:
-            switch(C8->opcode & 0x00FF)
+            switch(opcode & 0x00FF)
             {
-                case 0x009E:                                // EX9E: Skips the next instruction if the key stored in VX is pressed
-                    if(C8->key[C8->V[(C8->opcode & 0x0F00) >> 8]] == 1)
-                    {
-                        C8->key[C8->V[(C8->opcode & 0x0F00) >> 8]] = 0;
-                        C8->pc += 4;
-                    }
-                    else
-                        C8->pc += 2;
-                break;
-                case 0x00A1:                                 // EXA1: Skips the next instruction if the key stored in VX isn't pressed
-                    if(C8->key[C8->V[(C8->opcode & 0x0F00) >> 8]] != 1)
-                        C8->pc += 4;
-                    else
-                        C8->pc += 2;
-                break;
-                default:
-                    printf("Unknow opcode: 0x%x\n", C8->opcode);
+                case 0x009E: in->op = OP_EX9E; break;
+                case 0x00A1: in->op = OP_EXA1; break;
             }
         break;
         case 0xF000:
-            switch(C8->opcode & 0x00FF)
+            switch(opcode & 0x00FF)
             {
-                case 0x0007:                                      // FX07: Sets VX to the value of the delay timer
-                    C8->V[(C8->opcode & 0x0F00) >> 8] = C8->delay_timer;
-                    C8->pc += 2;
-                break;
-                case 0x000A:                                      // FX0A: A key press is awaited, and then stored in VX
-                    pressed = 0;
-                    for(i = 0; i < KEYNUM; i++){
-                        if(C8->key[i] != 0)
-                        {
-                            C8->key[i] = 0;
-                            C8->V[(C8->opcode & 0x0F00) >> 8] = i;
-                            pressed = 1;
-                        }
-                    }
-                    if(pressed == 0)
-                        return;
-                    C8->pc += 2;
-                break;
-                case 0x0015:                                      // FX15: Sets the delay timer to VX
-                    C8->delay_timer = C8->V[(C8->opcode & 0x0F00) >> 8];
-                    C8->pc += 2;
-                break;
-                case 0x0018:                                      // FX18: Sets the sound timer to VX
-                    C8->sound_timer = C8->V[(C8->opcode & 0x0F00) >> 8];
-                    C8->pc += 2;
-                break;
-                case 0x001E:                                      // FX1E: Adds VX to I, VF is set to 1 when range overflow, and 0 when there isn't.
-                    if(C8->I + C8->V[(C8->opcode & 0x0F00) >> 8] > 0xFFF)
-                        C8->V[0xF] = 1;
-                    else
-                        C8->V[0xF] = 0;
-                    C8->I += C8->V[(C8->opcode & 0x0F00) >> 8];
-                    C8->pc += 2;
-                break;
-                case 0x0029:                                      // FX29: Sets I to the location of the sprite for the character in VX. Characters 0-F are represented by a 4X5 font
-                    C8->I = C8->V[(C8->opcode & 0x0F00) >> 8] * 5;
-                    C8->pc += 2;
-                break;
-                case 0x0033:                                      // FX33: Stores the Binary-coded decimal representation of VX, with the most significant of three digits at the address I
-                    C8->memory[C8->I]   = C8->V[(C8->opcode & 0x0F00) >> 8] / 100;
-                    C8->memory[C8->I+1] = (C8->V[(C8->opcode & 0x0F00) >> 8] /10) % 10;
-                    C8->memory[C8->I+2] = (C8->V[(C8->opcode & 0x0F00) >> 8] %100) % 10;
-                    C8->pc += 2;
-                break;
-                case 0x0055:                                      // FX55: Stores V0 to VX in memory starting at address I
-                    for(i = 0; i <= C8->V[(C8->opcode & 0x0F00) >> 8]; i++)
-                        C8->memory[C8->I+i] = C8->V[i];
-                    C8->pc += 2;
-                break;
-                case 0x0065:                                      // FX65: Fills V0 to VX with values from memory starting at address I
-                    for(i = 0; i <= C8->V[(C8->opcode & 0x0F00) >> 8]; i++)
-                        C8->V[i] = C8->memory[C8->I + i];
-                    C8->pc += 2;
-                break;
-                default:
-                    printf("Unknow opcode: 0x%x\n", C8->opcode);
+                case 0x0001: in->op = OP_FN01; break;
+                case 0x0007: in->op = timer_loop(C8, addr) ? OP_WAIT : OP_FX07; break;
+                case 0x000A: in->op = OP_FX0A; break;
+                case 0x0015: in->op = OP_FX15; break;
+                case 0x0018: in->op = OP_FX18; break;
+                case 0x001E: in->op = OP_FX1E; break;
+                case 0x0029: in->op = OP_FX29; break;
+                case 0x0030: in->op = OP_FX30; break;
+                case 0x0033: in->op = OP_FX33; break;
+                case 0x0055: in->op = C8->quirks & QUIRK_MEMORY_I ? OP_FX55_I : OP_FX55; break;
+                case 0x0065: in->op = C8->quirks & QUIRK_MEMORY_I ? OP_FX65_I : OP_FX65; break;
+                case 0x0075: in->op = OP_FX75; break;
+                case 0x0085: in->op = OP_FX85; break;
             }
         break;
-        default:
-                    printf("Unknow opcode: 0x%x\n", C8->opcode);
     }
+}
+
+void decode_memory(CH *C8)
+{
+    int i;
+    for(i = 0; i < MEMOSZ; i++)
+        decode_insn(C8, i);
+}
+
+void invalidate_memory(CH *C8, unsigned short int addr, int len) // Memory at addr was written, the instructions overlapping it must be decoded again
+{
+    int i;
+    addr &= 0xFFF;
+    if(addr + len > MEMOSZ){                                // Wrapped past the end: the two ends of memory, one at a time
+        invalidate_memory(C8, addr, MEMOSZ - addr);
+        invalidate_memory(C8, 0, addr + len - MEMOSZ);
+        return;
+    }
+    for(i = -1; i < len; i++)
+        C8->decoded[(addr + i) & 0xFFF].op = OP_DECODE;
+    for(i = addr / PAGE; i <= (addr + len - 1) / PAGE; i++) // For save_state() and restore_state()
+        C8->dirty |= (uint64_t)1 << (i % PAGES);
+    if(C8->blocks != NULL)
+        invalidate_blocks(C8->blocks, addr, len);
+}
+
+void set_quirks(CH *C8, unsigned char q)
+{
+    if(C8->quirks == q)
+        return;
+    C8->quirks = q;
+    decode_memory(C8);
+    if(C8->blocks != NULL)                                  // Blocks hold copies of the old decoding
+        invalidate_blocks(C8->blocks, 0, MEMOSZ);
+}
+
+
+/*
+ * Handlers, one per instruction. They get the predecoded operands and are
+ * called through the handlers[] table below.
+ */
+
+static void op_decode(CH *C8, const INSN *in)               // The slot was invalidated: decode it again and run it
+{
+    unsigned short int addr = C8->pc & 0xFFF;
+    decode_insn(C8, addr);
+    in = &C8->decoded[addr];
+    C8->opcode = in->opcode;
+    handlers[in->op](C8, in);
+}
+
+static void op_unknown(CH *C8, const INSN *in)              // Counted, not printed: a machine stuck on one runs it every instruction
+{
+    C8->unknown++;
+}
+
+static void op_00E0(CH *C8, const INSN *in)                 // 00E0: Clears the screen, the selected planes of it
+{
+    int p;
+    for(p = 0; p < PLANES; p++)
+        if(C8->planes & (1 << p))
+            clear_graphics(C8->graphics[p][0], C8->hires ? HIRES_H : H);
+    C8->draw = 1;
+    C8->pc += 2;
+}
+
+static void op_00EE(CH *C8, const INSN *in)                 // 00EE: Returns from a subroutine
+{
+    C8->ps--;                                               // Decrease stack pointer to avoid overwriting
+    C8->pc = C8->stack[C8->ps % STACKS];                    // Put the address into the program counter. A game that returns too often, or calls too deep, wraps around the stack rather than out of it
+    C8->pc += 2;
+}
+
+static void op_00CN(CH *C8, const INSN *in)                 // 00CN: Scrolls the screen down N rows (SUPER-CHIP)
+{
+    int p, rows = C8->hires ? HIRES_H : H, n = in->nn & 0x0F;
+    for(p = 0; p < PLANES; p++)                             // Whole rows move, a memmove per plane
+    {
+        if(!(C8->planes & (1 << p)))
+            continue;
+        memmove(C8->graphics[p][n], C8->graphics[p][0], (rows - n) * sizeof(C8->graphics[p][0]));
+        memset(C8->graphics[p][0], 0, n * sizeof(C8->graphics[p][0]));
+    }
+    C8->draw = 1;
+    C8->pc += 2;
+}
+
+static void op_00DN(CH *C8, const INSN *in)                 // 00DN: Scrolls the screen up N rows (XO-CHIP)
+{
+    int p, rows = C8->hires ? HIRES_H : H, n = in->nn & 0x0F;
+    for(p = 0; p < PLANES; p++)
+    {
+        if(!(C8->planes & (1 << p)))
+            continue;
+        memmove(C8->graphics[p][0], C8->graphics[p][n], (rows - n) * sizeof(C8->graphics[p][0]));
+        memset(C8->graphics[p][rows - n], 0, n * sizeof(C8->graphics[p][0]));
+    }
+    C8->draw = 1;
+    C8->pc += 2;
+}
+
+static void op_00FB(CH *C8, const INSN *in)                 // 00FB: Scrolls the screen right 4 pixels (SUPER-CHIP)
+{
+    int p, y, rows = C8->hires ? HIRES_H : H;
+    uint64_t (*g)[2];
+    for(p = 0; p < PLANES; p++)                             // A shift of the row's words, what goes past the edge is lost
+    {
+        if(!(C8->planes & (1 << p)))
+            continue;
+        g = C8->graphics[p];
+        for(y = 0; y < rows; y++){
+            g[y][1] = C8->hires ? g[y][1] >> 4 | g[y][0] << 60 : 0;
+            g[y][0] >>= 4;
+        }
+    }
+    C8->draw = 1;
+    C8->pc += 2;
+}
+
+static void op_00FC(CH *C8, const INSN *in)                 // 00FC: Scrolls the screen left 4 pixels (SUPER-CHIP)
+{
+    int p, y, rows = C8->hires ? HIRES_H : H;
+    uint64_t (*g)[2];
+    for(p = 0; p < PLANES; p++)
+    {
+        if(!(C8->planes & (1 << p)))
+            continue;
+        g = C8->graphics[p];
+        for(y = 0; y < rows; y++){
+            g[y][0] = g[y][0] << 4 | g[y][1] >> 60;
+            g[y][1] <<= 4;
+        }
+    }
+    C8->draw = 1;
+    C8->pc += 2;
+}
+
+static void op_00FD(CH *C8, const INSN *in)                 // 00FD: Exits the interpreter (SUPER-CHIP). The machine stays on it for good
+{
+}
+
+static void set_resolution(CH *C8, int hires)               // 00FE and 00FF: switch modes, the screen is cleared
+{
+    int p;
+    for(p = 0; p < PLANES; p++)
+        clear_graphics(C8->graphics[p][0], HIRES_H);
+    C8->hires = hires;
+    C8->draw = 1;
+    C8->pc += 2;
+}
+
+static void op_00FE(CH *C8, const INSN *in)                 // 00FE: 64x32 (SUPER-CHIP)
+{
+    set_resolution(C8, 0);
+}
+
+static void op_00FF(CH *C8, const INSN *in)                 // 00FF: 128x64 (SUPER-CHIP)
+{
+    set_resolution(C8, 1);
+}
+
+static void op_1NNN(CH *C8, const INSN *in)                 // 1NNN: Jumps to address NNN
+{
+    C8->pc = in->opcode & 0x0FFF;
+}
+
+static void op_2NNN(CH *C8, const INSN *in)                 // 2NNN: Calls subroutine at NNN
+{
+    C8->stack[C8->ps % STACKS] = C8->pc;                    // Store address on pointer stack
+    C8->ps++;                                               // Increase stack pointer to avoid overwriting
+    C8->pc = in->opcode & 0x0FFF;                           // Set program counter to the address at NNN
+}
+
+static void op_3XNN(CH *C8, const INSN *in)                 // 3XNN: Skips the next instruction if VX equals NN
+{
+    C8->pc += C8->V[in->x] == in->nn ? 4 : 2;
+}
+
+static void op_4XNN(CH *C8, const INSN *in)                 // 4XNN: Skips the next instruction if VX doesn't equal NN
+{
+    C8->pc += C8->V[in->x] != in->nn ? 4 : 2;
+}
+
+static void op_5XY0(CH *C8, const INSN *in)                 // 5XY0: Skips the next instruction if VX equals VY
+{
+    C8->pc += C8->V[in->x] == C8->V[in->y] ? 4 : 2;
+}
+
+static void op_5XY2(CH *C8, const INSN *in)                 // 5XY2: Stores VX to VY in memory starting at address I, backwards when X > Y. I is left alone (XO-CHIP)
+{
+    int i, n = (in->x > in->y ? in->x - in->y : in->y - in->x) + 1, d = in->x > in->y ? -1 : 1;
+    for(i = 0; i < n; i++)
+        C8->memory[(C8->I + i) & 0xFFF] = C8->V[in->x + d * i];
+    invalidate_memory(C8, C8->I & 0xFFF, n);
+    C8->pc += 2;
+}
+
+static void op_5XY3(CH *C8, const INSN *in)                 // 5XY3: Loads VX to VY from memory starting at address I, the same way (XO-CHIP)
+{
+    int i, n = (in->x > in->y ? in->x - in->y : in->y - in->x) + 1, d = in->x > in->y ? -1 : 1;
+    for(i = 0; i < n; i++)
+        C8->V[in->x + d * i] = C8->memory[(C8->I + i) & 0xFFF];
+    C8->pc += 2;
+}
+
+static void op_6XNN(CH *C8, const INSN *in)                 // 6XNN: Sets VX to NN
+{
+    C8->V[in->x] = in->nn;
+    C8->pc += 2;
+}
+
+static void op_7XNN(CH *C8, const INSN *in)                 // 7XNN: Adds NN to VX
+{
+    C8->V[in->x] += in->nn;
+    C8->pc += 2;
+}
+
+static void op_8XY0(CH *C8, const INSN *in)                 // 8XY0: Sets VX to the value of VY
+{
+    C8->V[in->x] = C8->V[in->y];
+    C8->pc += 2;
+}
+
+/*
+ * The instructions with quirks are generated, one handler per reading,
+ * from a macro whose quirk argument is a constant: each handler is
+ * compiled with its reading folded in and decode_insn() picks which one
+ * an address runs.
+ */
+
+#define LOGIC(name, op, reset)                                                  \
+static void name(CH *C8, const INSN *in)                                        \
+{                                                                               \
+    C8->V[in->x] op C8->V[in->y];                                               \
+    if(reset)                                                                   \
+        C8->V[0xF] = 0;                                                         \
+    C8->pc += 2;                                                                \
+}
+
+LOGIC(op_8XY1, |=, 0)                                       // 8XY1: Sets VX to VX or VY
+LOGIC(op_8XY2, &=, 0)                                       // 8XY2: Sets VX to VX and VY
+LOGIC(op_8XY3, ^=, 0)                                       // 8XY3: Sets VX to VX xor VY
+LOGIC(op_8XY1_VF, |=, 1)                                    // The same, then VF is set to 0, as the COSMAC VIP did
+LOGIC(op_8XY2_VF, &=, 1)
+LOGIC(op_8XY3_VF, ^=, 1)
+
+static void op_8XY4(CH *C8, const INSN *in)                 // 8XY4: Adds VY to VX. VF is set to 1 when there's a carry, and to 0 when there isn't
+{
+    C8->V[0xF] = C8->V[in->y] > (0xFF - C8->V[in->x]);
+    C8->V[in->x] += C8->V[in->y];
+    C8->pc += 2;
+}
+
+static void op_8XY5(CH *C8, const INSN *in)                 // 8XY5: VY is subtracted from VX. VF is set to 0 when there's a borrow, and 1 when there isn't
+{
+    C8->V[0xF] = C8->V[in->y] <= C8->V[in->x];             // If VY > VX, there is a borrow
+    C8->V[in->x] -= C8->V[in->y];
+    C8->pc += 2;
+}
+
+#define SHIFT(name, from, flag, shifted)                                        \
+static void name(CH *C8, const INSN *in)                                        \
+{                                                                               \
+    unsigned char v;                                                            \
+    C8->V[0xF] = C8->V[from] flag;                                              \
+    v = C8->V[from];                                                            \
+    C8->V[in->x] = shifted;                                                     \
+    C8->pc += 2;                                                                \
+}
+
+SHIFT(op_8XY6, in->x, & 0x1, v >> 1)                        // 8XY6: Shifts VX right by one: VF is set to the value of the least significant bit of VX before the shift
+SHIFT(op_8XYE, in->x, >> 7, v << 1)                         // 8XYE: Shifts VX left by one. VF is set to the value of the most significant bit of VX before the shift
+SHIFT(op_8XY6_VY, in->y, & 0x1, v >> 1)                     // The same with VY shifted into VX, as the COSMAC VIP did
+SHIFT(op_8XYE_VY, in->y, >> 7, v << 1)
+
+static void op_8XY7(CH *C8, const INSN *in)                 // 8XY7: Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1 when there isn't
+{
+    C8->V[0xF] = C8->V[in->x] <= C8->V[in->y];             // If VX > VY , there is a borrow
+    C8->V[in->x] = C8->V[in->y] - C8->V[in->x];
+    C8->pc += 2;
+}
+
+static void op_9XY0(CH *C8, const INSN *in)                 // 9XY0: Skips the next instruction if VX doesn't equal VY
+{
+    C8->pc += C8->V[in->x] != C8->V[in->y] ? 4 : 2;
+}
+
+static void op_ANNN(CH *C8, const INSN *in)                 // ANNN: Sets I to the address NNN
+{
+    C8->I = in->opcode & 0x0FFF;
+    C8->pc += 2;
+}
+
+#define JUMP(name, reg)                                                         \
+static void name(CH *C8, const INSN *in)                                        \
+{                                                                               \
+    C8->pc = (in->opcode & 0x0FFF) + C8->V[reg];                                \
+}
+
+JUMP(op_BNNN, 0x0)                                          // BNNN: Jumps to the address NNN plus V0
+JUMP(op_BXNN, in->x)                                        // The same plus VX, X being the top of NNN, as SUPER-CHIP did
+
+static void op_CXNN(CH *C8, const INSN *in)                 // CXNN: Sets VX to a random number and NN
+{
+    C8->V[in->x] = (next_random(C8) % 0xFF) & in->nn;
+    C8->pc += 2;
+}
+
+static inline uint64_t sprite_row(CH *C8, unsigned short int addr, const int wide) // A row of a sprite in the top bits of a word, 16 pixels for DXY0
+{
+    if(wide)
+        return (uint64_t)(C8->memory[addr & 0xFFF] << 8 | C8->memory[(addr + 1) & 0xFFF]) << 48;
+    return (uint64_t)C8->memory[addr & 0xFFF] << 56;
+}
+
+static inline uint64_t draw_lores(CH *C8, uint64_t (*plane)[2], unsigned int vx, unsigned int vy, unsigned int height, unsigned short int addr, const int wide)
+{
+    unsigned int yline, y;
+    uint64_t row, hit = 0;
+
+    vx &= W - 1;
+    vy &= H - 1;
+    for(yline = 0; yline < height; yline++){                // All drawing is XOR drawing, a whole sprite row at a time
+        row = sprite_row(C8, addr + (yline << wide), wide);
+        row = row >> vx | row << ((W - vx) & (W - 1));      // Rotate the row into place, what goes past the right edge comes back on the left
+        y = (vy + yline) & (H - 1);
+        hit |= plane[y][0] & row;
+        plane[y][0] ^= row;
+    }
+    return hit;
+}
+
+static inline uint64_t draw_hires(CH *C8, uint64_t (*plane)[2], unsigned int vx, unsigned int vy, unsigned int height, unsigned short int addr, const int wide)
+{
+    unsigned int yline, y, k, o;
+    uint64_t row, spill, hit = 0;
+
+    vx &= HIRES_W - 1;
+    vy &= HIRES_H - 1;
+    k = vx >> 6;                                            // The word the sprite starts in, the rest spills into the other one
+    o = vx & 63;
+    for(yline = 0; yline < height; yline++){                // Two words a row, rotated across both: 128 pixels wrap the same way
+        row = sprite_row(C8, addr + (yline << wide), wide);
+        spill = row << 1 << (63 - o);                       // 0 when the sprite sits on a word boundary
+        row >>= o;
+        y = (vy + yline) & (HIRES_H - 1);
+        hit |= (plane[y][k] & row) | (plane[y][k ^ 1] & spill);
+        plane[y][k] ^= row;
+        plane[y][k ^ 1] ^= spill;
+    }
+    return hit;
+}
+
+__attribute__((noinline)) static unsigned char draw_planes(CH *C8, unsigned int vx, unsigned int vy, unsigned int height, unsigned short int addr) // draw_sprite() in every other case. Not inlined, plain CHIP-8 would pay for its registers
+{
+    unsigned int p, wide = height == 0;
+    uint64_t hit = 0;
+
+    if(wide)                                                // DXY0: 16x16, two bytes a row
+        height = 16;
+    for(p = 0; p < PLANES; p++)
+    {
+        if(!(C8->planes & (1 << p)))
+            continue;
+        if(C8->hires)
+            hit |= wide ? draw_hires(C8, C8->graphics[p], vx, vy, height, addr, 1) : draw_hires(C8, C8->graphics[p], vx, vy, height, addr, 0);
+        else
+            hit |= wide ? draw_lores(C8, C8->graphics[p], vx, vy, height, addr, 1) : draw_lores(C8, C8->graphics[p], vx, vy, height, addr, 0);
+        addr += height << wide;                             // Each plane has its own sprite, one after the other
+    }
+    return hit != 0;
+}
+
+unsigned char draw_sprite(CH *C8, unsigned int vx, unsigned int vy, unsigned int height, unsigned short int addr)
+{
+    C8->draw = 1;
+    if(C8->planes != 1 || C8->hires || height == 0)         // Only plain CHIP-8 is drawn here
+        return draw_planes(C8, vx, vy, height, addr);
+    return draw_lores(C8, C8->graphics[0], vx, vy, height, addr, 0) != 0; // If when drawn, clears a pixel, register VF is set to 1 otherwise it is zero
+}
+
+static void op_DXYN(CH *C8, const INSN *in)                 // DXYN: Sprites stored in memory at location in index register, maximum 8bits wide. Wraps around the screen.
+{
+    C8->V[0xF] = draw_sprite(C8, C8->V[in->x], C8->V[in->y], in->opcode & 0x000F, C8->I);
+    C8->pc += 2;
+}
+
+static void op_EX9E(CH *C8, const INSN *in)                 // EX9E: Skips the next instruction if the key stored in VX is pressed
+{
+    if(C8->key[C8->V[in->x]] == 1)
+    {
+        C8->key[C8->V[in->x]] = 0;
+        C8->pc += 4;
+    }
+    else
+        C8->pc += 2;
+}
+
+static void op_EXA1(CH *C8, const INSN *in)                 // EXA1: Skips the next instruction if the key stored in VX isn't pressed
+{
+    C8->pc += C8->key[C8->V[in->x]] != 1 ? 4 : 2;
+}
+
+static void op_FX07(CH *C8, const INSN *in)                 // FX07: Sets VX to the value of the delay timer
+{
+    C8->V[in->x] = C8->delay_timer;
+    C8->pc += 2;
+}
+
+static void op_FX0A(CH *C8, const INSN *in)                 // FX0A: A key press is awaited, and then stored in VX
+{
+    int i, pressed = 0;
+    for(i = 0; i < KEYNUM; i++){
+        if(C8->key[i] != 0)
+        {
+            C8->key[i] = 0;
+            C8->V[in->x] = i;
+            pressed = 1;
+        }
+    }
+    if(pressed == 1)                                        // Otherwise stay on this instruction until a key comes
+        C8->pc += 2;
+}
+
+static void op_FX15(CH *C8, const INSN *in)                 // FX15: Sets the delay timer to VX
+{
+    C8->delay_timer = C8->V[in->x];
+    C8->pc += 2;
+}
+
+static void op_FX18(CH *C8, const INSN *in)                 // FX18: Sets the sound timer to VX
+{
+    C8->sound_timer = C8->V[in->x];
+    if(C8->audio != NULL)
+        sound_edge(C8->audio, C8);
+    C8->pc += 2;
+}
+
+static void op_FX1E(CH *C8, const INSN *in)                 // FX1E: Adds VX to I, VF is set to 1 when range overflow, and 0 when there isn't.
+{
+    C8->V[0xF] = C8->I + C8->V[in->x] > 0xFFF;
+    C8->I += C8->V[in->x];
+    C8->pc += 2;
+}
+
+static void op_FX29(CH *C8, const INSN *in)                 // FX29: Sets I to the location of the sprite for the character in VX. Characters 0-F are represented by a 4X5 font
+{
+    C8->I = C8->V[in->x] * 5;
+    C8->pc += 2;
+}
+
+static void op_FX30(CH *C8, const INSN *in)                 // FX30: Sets I to the location of the 8x10 sprite for the character in VX (SUPER-CHIP)
+{
+    C8->I = BIGFONT + (C8->V[in->x] & 0x0F) * 10;
+    C8->pc += 2;
+}
+
+static void op_FN01(CH *C8, const INSN *in)                 // FN01: Selects the planes N to draw, clear and scroll (XO-CHIP)
+{
+    C8->planes = in->x & 0x3;
+    C8->pc += 2;
+}
+
+static void op_FX33(CH *C8, const INSN *in)                 // FX33: Stores the Binary-coded decimal representation of VX, with the most significant of three digits at the address I
+{
+    unsigned char vx = C8->V[in->x];
+    C8->memory[C8->I & 0xFFF]       = vx / 100;
+    C8->memory[(C8->I + 1) & 0xFFF] = (vx / 10) % 10;
+    C8->memory[(C8->I + 2) & 0xFFF] = vx % 10;
+    invalidate_memory(C8, C8->I & 0xFFF, 3);
+    C8->pc += 2;
+}
+
+#define STORE(name, moved)                                                      \
+static void name(CH *C8, const INSN *in)                                        \
+{                                                                               \
+    int i;                                                                      \
+    for(i = 0; i <= in->x; i++)                                                 \
+        C8->memory[(C8->I + i) & 0xFFF] = C8->V[i];                             \
+    invalidate_memory(C8, C8->I & 0xFFF, i);                                    \
+    if(moved)                                                                   \
+        C8->I += i;                                                             \
+    C8->pc += 2;                                                                \
+}
+
+#define LOAD(name, moved)                                                       \
+static void name(CH *C8, const INSN *in)                                        \
+{                                                                               \
+    int i;                                                                      \
+    for(i = 0; i <= in->x; i++)                                                 \
+        C8->V[i] = C8->memory[(C8->I + i) & 0xFFF];                             \
+    if(moved)                                                                   \
+        C8->I += i;                                                             \
+    C8->pc += 2;                                                                \
+}
+
+STORE(op_FX55, 0)                                           // FX55: Stores V0 to VX in memory starting at address I
+LOAD(op_FX65, 0)                                            // FX65: Fills V0 to VX with values from memory starting at address I
+STORE(op_FX55_I, 1)                                         // The same, leaving I after the last register, as the COSMAC VIP did
+LOAD(op_FX65_I, 1)
+
+static void op_FX75(CH *C8, const INSN *in)                 // FX75: Stores V0 to VX in the user flags (SUPER-CHIP)
+{
+    memcpy(C8->flags, C8->V, in->x + 1);
+    C8->pc += 2;
+}
+
+static void op_FX85(CH *C8, const INSN *in)                 // FX85: Fills V0 to VX from the user flags (SUPER-CHIP)
+{
+    memcpy(C8->V, C8->flags, in->x + 1);
+    C8->pc += 2;
+}
+
+void (*const handlers[OPS])(CH *, const INSN *) =           // Indexed by the op of a predecoded instruction
+{
+    [OP_DECODE] = op_decode,   [OP_UNKNOWN] = op_unknown,
+    [OP_00E0] = op_00E0, [OP_00EE] = op_00EE, [OP_1NNN] = op_1NNN, [OP_2NNN] = op_2NNN,
+    [OP_3XNN] = op_3XNN, [OP_4XNN] = op_4XNN, [OP_5XY0] = op_5XY0, [OP_6XNN] = op_6XNN,
+    [OP_7XNN] = op_7XNN, [OP_8XY0] = op_8XY0, [OP_8XY1] = op_8XY1, [OP_8XY2] = op_8XY2,
+    [OP_8XY3] = op_8XY3, [OP_8XY4] = op_8XY4, [OP_8XY5] = op_8XY5, [OP_8XY6] = op_8XY6,
+    [OP_8XY7] = op_8XY7, [OP_8XYE] = op_8XYE, [OP_9XY0] = op_9XY0, [OP_ANNN] = op_ANNN,
+    [OP_BNNN] = op_BNNN, [OP_CXNN] = op_CXNN, [OP_DXYN] = op_DXYN, [OP_EX9E] = op_EX9E,
+    [OP_EXA1] = op_EXA1, [OP_FX07] = op_FX07, [OP_WAIT] = op_FX07, [OP_FX0A] = op_FX0A, [OP_FX15] = op_FX15,
+    [OP_FX18] = op_FX18, [OP_FX1E] = op_FX1E, [OP_FX29] = op_FX29, [OP_FX33] = op_FX33,
+    [OP_FX55] = op_FX55, [OP_FX65] = op_FX65,
+    [OP_00CN] = op_00CN, [OP_00DN] = op_00DN, [OP_00FB] = op_00FB, [OP_00FC] = op_00FC,
+    [OP_00FD] = op_00FD, [OP_00FE] = op_00FE, [OP_00FF] = op_00FF, [OP_5XY2] = op_5XY2,
+    [OP_5XY3] = op_5XY3, [OP_FN01] = op_FN01, [OP_FX30] = op_FX30, [OP_FX75] = op_FX75,
+    [OP_FX85] = op_FX85,
+    [OP_8XY1_VF] = op_8XY1_VF, [OP_8XY2_VF] = op_8XY2_VF, [OP_8XY3_VF] = op_8XY3_VF,
+    [OP_8XY6_VY] = op_8XY6_VY, [OP_8XYE_VY] = op_8XYE_VY, [OP_BXNN] = op_BXNN,
+    [OP_FX55_I] = op_FX55_I, [OP_FX65_I] = op_FX65_I
+};
+
+static inline void step(CH *C8)                             // Run the instruction at PC through the handler table
+{
+    run_insn(C8, &C8->decoded[C8->pc & 0xFFF]);
+}
+
+void tick_timers(CH *C8)
+{
     if(C8->delay_timer > 0)
         --C8->delay_timer;
     if(C8->sound_timer > 0)
         --C8->sound_timer;
+    if(C8->audio != NULL){
+        C8->audio->ticks++;
+        sound_edge(C8->audio, C8);
+    }
+}
+
+static void run_profiled(CH *C8, unsigned long n)          // run_cycles() with every instruction shown to the profiler first
+{
+    const INSN *in;
+    unsigned long idle;
 
-    SDL_Delay(2);
+    while(n > 0)
+    {
+        if((idle = skip_idle(C8, n)) > 0){
+            count_idle(C8->profile, C8, idle);
+            n -= idle;
+            continue;
+        }
+        in = &C8->decoded[C8->pc & 0xFFF];
+        if(in->op == OP_DECODE)                             // Count it as what it is
+            decode_insn(C8, C8->pc & 0xFFF);
+        count_insn(C8->profile, C8, in);
+        step(C8);
+        n--;
+    }
 }
 
-void render(CH *C8)
+static uint16_t key_mask(const CH *C8)                     // Keys down, bit N for key N
 {
-        int y, x;
-        for (y = 0; y < H; y++)                         // Render the emulator on screen using SDL
-        {
-            for (x = 0; x < W; x++)
-            {
-                SDL_Rect pixel;                         // To creates a rectangular area on screen
-                pixel.x = x * scale;                    // Set the x, y, height and width location on screen
-                pixel.y = y * scale;
-                pixel.w = scale;
-                pixel.h = scale;
-
-                uint32_t pixel_color;
-
-                if (C8->graphics[(y * W) + x])          // If this is number on the graphics is 1, set it white, else it's black
-                {                                       // If in doubt, refer to instruction set DXYN
-                    pixel_color = 0xFFFFFF;
-                }
-                else
-                {
-                    pixel_color = 0x0;
-                }
-                SDL_FillRect(surface, &pixel, pixel_color); // Fill the rectangle with black or white
-                }
-            }
-        SDL_UpdateWindowSurface(window);                // Update the screen
-    color = 0;                                          // Set the color 0 to not keep drawing over and over
+    uint16_t keys = 0;
+    int i;
+    for(i = 0; i < KEYNUM; i++)
+        keys |= (C8->key[i] != 0) << i;
+    return keys;
 }
 
-void start()
+static const unsigned char ends_run[OPS] =                  // Where a trace record stops whatever the PC does next: writes to memory, keys read, and what isn't decoded yet
+{
+    [OP_DECODE] = 1, [OP_FX33] = 1, [OP_FX55] = 1, [OP_FX55_I] = 1, [OP_5XY2] = 1, [OP_EX9E] = 1, [OP_FX0A] = 1
+};
+
+__attribute__((always_inline)) static inline void traced(CH *C8, unsigned long n, const int profiling) // run_cycles() with every instruction coded into the trace, idle waits included
 {
-    char game[50];
-    printf("Write the name of the game: ");
-    scanf("%s", game);
-    getchar();
+    const INSN *in;
+    unsigned int run, left;
+    uint16_t keys = key_mask(C8), start, pc, wrote = 0;     // Keys change between runs, and when EX9E or FX0A takes one
+    unsigned char op;
+    int written;
 
-    initalize(game);
+    C8->trace->records += n;
+    while(n > 0)
+    {
+        run = left = n < TRACE_RUN ? n : TRACE_RUN;
+        start = C8->pc;
+        written = 0;
+        for(;;)                                             // A run: per instruction, only what ends it
+        {
+            pc = C8->pc;
+            in = &C8->decoded[pc & 0xFFF];
+            if(profiling){
+                if(in->op == OP_DECODE)
+                    decode_insn(C8, pc & 0xFFF);
+                count_insn(C8->profile, C8, in);
+            }
+            if(ends_run[in->op]){                           // The run's last, out of the way of the rest
+                if(in->op == OP_DECODE)                     // For the opcode, which is stale until then
+                    decode_insn(C8, pc & 0xFFF);
+                written = trace_write(C8, in, &wrote);      // Before it runs, FX55 may move I
+                run_insn(C8, in);
+                left--;
+                break;
+            }
+            run_insn(C8, in);
+            if(--left == 0 || ((uint16_t)(C8->pc - pc - 2) & ~2) != 0)
+                break;
+        }
+        n -= run - left;
+        code_trace(C8, run - left, start, written, wrote, keys);
+        op = C8->decoded[pc & 0xFFF].op;
+        if(op == OP_EX9E || op == OP_FX0A)                  // They let go of the key they read, the next run must not hold it
+            keys = key_mask(C8);
+    }
+    atomic_store_explicit(&C8->trace->tail, C8->trace->next, memory_order_release);
 }
 
-void initalize(char *game)
+static void run_traced(CH *C8, unsigned long n)            // One loop for tracing alone and one that profiles as well
 {
-    CH C8;
-    prepare_emulator(&C8, game);                        // Resets everything
+    if(C8->profile != NULL)
+        traced(C8, n, 1);
+    else
+        traced(C8, n, 0);
+}
 
-    if(SDL_Init(SDL_INIT_EVERYTHING) == -1)
-        return;
+void cycles(CH *C8)
+{
+    if(C8->trace != NULL)
+        run_traced(C8, 1);
+    else if(C8->profile != NULL)
+        run_profiled(C8, 1);
+    else
+        step(C8);
+}
 
-    window = SDL_CreateWindow("CHIP-8 EMULATOR BY VIATA", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
+void pass_cycles(CH *C8, unsigned long n)
+{
+    unsigned long total = C8->tick + n, ticks;
 
-    if(window == NULL)
+    if(total < C8->ipf){
+        C8->tick = total;
         return;
+    }
+    ticks = total / C8->ipf;
+    if(C8->audio != NULL){                                  // The sound stops at the tick that takes the timer to 0
+        if(C8->sound_timer > 0 && ticks >= C8->sound_timer && C8->audio->on)
+            post_edge(C8->audio, C8->audio->ticks + C8->sound_timer, 0, C8->ipf, 0);
+        C8->audio->ticks += ticks;
+    }
+    C8->tick = total % C8->ipf;
+    C8->delay_timer = ticks < C8->delay_timer ? C8->delay_timer - ticks : 0;
+    C8->sound_timer = ticks < C8->sound_timer ? C8->sound_timer - ticks : 0;
+}
 
-    surface = SDL_GetWindowSurface(window);
+static unsigned long wait_timer(CH *C8, unsigned long n)    // The loop at PC spins on FX07 until the delay timer gets somewhere: run it a frame at a time
+{
+    unsigned short int pc = C8->pc & 0xFFF, skip;
+    int kind = timer_loop(C8, pc), taken;
+    unsigned long k, done = 0;
+    unsigned char v;
 
-    SDL_Event event;                                   // To get inputs
+    if(kind == 0 || C8->tick >= C8->ipf)                    // The pattern was overwritten since it was decoded
+        return 0;
+    skip = word(C8, pc + 2);
     for(;;)
     {
-        SDL_PollEvent(&event);
+        v = C8->delay_timer;
+        taken = (v == (skip & 0x00FF)) == ((skip & 0xF000) == 0x3000);
+        if(taken == (kind == 1))                            // This time round it leaves the loop
+            break;
+        if(v == 0)                                          // And it never will, the timer is stopped
+            k = (n - done) / 3;
+        else                                                // Every round whose FX07 comes before the next tick reads the same value
+            k = (C8->ipf - C8->tick - 1) / 3 + 1;
+        if(k > (n - done) / 3)
+            k = (n - done) / 3;
+        if(k == 0)
+            break;
+        C8->V[(C8->memory[pc] & 0x0F)] = v;
+        pass_cycles(C8, 3 * k);                             // FX07, the skip, the jump back
+        done += 3 * k;
+    }
+    if(done > 0)
+        C8->opcode = word(C8, pc + 2 * kind + 2);
+    return done;
+}
 
-            if(event.type == SDL_KEYDOWN)              // Set inputs
-            {
-                switch(event.key.keysym.sym)
-                {
-                    case SDLK_1: C8.key[0x1] = 1; break;
-                    case SDLK_2: C8.key[0x2] = 1; break;
-                    case SDLK_3: C8.key[0x3] = 1; break;
-                    case SDLK_4: C8.key[0xC] = 1; break;
-                    case SDLK_q: C8.key[0x4] = 1; break;
-                    case SDLK_w: C8.key[0x5] = 1; break;
-                    case SDLK_e: C8.key[0x6] = 1; break;
-                    case SDLK_r: C8.key[0xD] = 1; break;
-                    case SDLK_a: C8.key[0x7] = 1; break;
-                    case SDLK_s: C8.key[0x8] = 1; break;
-                    case SDLK_d: C8.key[0x9] = 1; break;
-                    case SDLK_f: C8.key[0xE] = 1; break;
-                    case SDLK_z: C8.key[0xA] = 1; break;
-                    case SDLK_x: C8.key[0x0] = 1; break;
-                    case SDLK_c: C8.key[0xB] = 1; break;
-                    case SDLK_v: C8.key[0xF] = 1; break;
-                    case SDLK_ESCAPE: exit(1); break;
-                }
-            }
-            else if (event.type == SDL_KEYUP)
-            {
-                switch(event.key.keysym.sym)
-                {
-                    case SDLK_1: C8.key[0x1] = 0; break;
-                    case SDLK_2: C8.key[0x2] = 0; break;
-                    case SDLK_3: C8.key[0x3] = 0; break;
-                    case SDLK_4: C8.key[0xC] = 0; break;
-                    case SDLK_q: C8.key[0x4] = 0; break;
-                    case SDLK_w: C8.key[0x5] = 0; break;
-                    case SDLK_e: C8.key[0x6] = 0; break;
-                    case SDLK_r: C8.key[0xD] = 0; break;
-                    case SDLK_a: C8.key[0x7] = 0; break;
-                    case SDLK_s: C8.key[0x8] = 0; break;
-                    case SDLK_d: C8.key[0x9] = 0; break;
-                    case SDLK_f: C8.key[0xE] = 0; break;
-                    case SDLK_z: C8.key[0xA] = 0; break;
-                    case SDLK_x: C8.key[0x0] = 0; break;
-                    case SDLK_c: C8.key[0xB] = 0; break;
-                    case SDLK_v: C8.key[0xF] = 0; break;
-                    }
-                }
-
-
-        if(color == 1)                                 // Draws only when required
-            render(&C8);
-        cycles(&C8);                                   // To keep the cycles running all the time
+unsigned long skip_idle(CH *C8, unsigned long n)
+{
+    const INSN *in = &C8->decoded[C8->pc & 0xFFF];
+    int i;
+
+    if(in->op == OP_WAIT)
+        return wait_timer(C8, n);
+    if(in->op != OP_FX0A)
+        return 0;
+    for(i = 0; i < KEYNUM; i++)                             // FX0A stays put until a key is down, and keys only change between runs
+        if(C8->key[i] != 0)
+            return 0;
+    C8->opcode = in->opcode;
+    pass_cycles(C8, n);
+    return n;
+}
+
+int sleeping(CH *C8)
+{
+    int i;
+    if(C8->decoded[C8->pc & 0xFFF].op != OP_FX0A || C8->delay_timer > 0 || C8->sound_timer > 0)
+        return 0;
+    for(i = 0; i < KEYNUM; i++)
+        if(C8->key[i] != 0)
+            return 0;
+    return 1;
+}
+
+void run_cycles(CH *C8, unsigned long n)
+{
+    unsigned long idle;
+    unsigned char op;
+
+    if(C8->trace != NULL){
+        run_traced(C8, n);
+        return;
+    }
+    if(C8->profile != NULL){
+        run_profiled(C8, n);
+        return;
+    }
+    while(n > 0)
+    {
+        op = C8->decoded[C8->pc & 0xFFF].op;
+        if((unsigned char)(op - OP_WAIT) <= OP_FX0A - OP_WAIT && (idle = skip_idle(C8, n)) > 0){
+            n -= idle;
+            continue;
+        }
+        step(C8);
+        n--;
     }
+}
 
-    SDL_DestroyWindow(window);
-    SDL_Quit();
+void run_frame(CH *C8)
+{
+    run_cycles(C8, C8->tick < C8->ipf ? C8->ipf - C8->tick : 1);
 }
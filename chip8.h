@@ -23,13 +23,51 @@
 #define CHIP8_H_INCLUDED
 
 #include <stdio.h>
-#include <SDL.h>
+#include <stdint.h>
 
 #define MEMOSZ 4096 //0xFFF
-#define GRAPHICS 64*32
+#define GRAPHICS 64*32                                   // Pixels of the screen
+#define W 64                                            // Width of the emulator screen
+#define H 32                                            // Height of the emulator screen
+#define HIRES_W 128                                     // Width of the SUPER-CHIP high resolution screen
+#define HIRES_H 64                                      // And its height
+#define PLANES 2                                        // Bitplanes of XO-CHIP, plain CHIP-8 only draws to the first
 #define REGISTER 0x10 // 16
 #define STACKS 0x10 // 16
 #define KEYNUM 0x10 // 16
+#define PAGE 64                         // Memory is tracked for writes in pages of this size
+#define PAGES (MEMOSZ / PAGE)           // 64, one bit each in CH.dirty
+#define ROMMAX (MEMOSZ - 0x200)         // 3584, the largest game: from 0x200 to the end of memory
+#define IPF 10                          // Instructions per 60 Hz frame unless told otherwise, 600 a second
+
+
+enum                                    // Handler of a predecoded instruction, one per CHIP-8 instruction
+{
+    OP_DECODE,                          // Not decoded yet, or the memory under it was written since
+    OP_UNKNOWN,
+    OP_00E0, OP_00EE, OP_1NNN, OP_2NNN, OP_3XNN, OP_4XNN, OP_5XY0, OP_6XNN,
+    OP_7XNN, OP_8XY0, OP_8XY1, OP_8XY2, OP_8XY3, OP_8XY4, OP_8XY5, OP_8XY6,
+    OP_8XY7, OP_8XYE, OP_9XY0, OP_ANNN, OP_BNNN, OP_CXNN, OP_DXYN, OP_EX9E,
+    OP_EXA1, OP_FX07,
+    OP_WAIT,                            // FX07 at the head of a loop waiting on the delay timer. Kept next to OP_FX0A, the other idle wait
+    OP_FX0A, OP_FX15, OP_FX18, OP_FX1E, OP_FX29, OP_FX33, OP_FX55, OP_FX65,
+    OP_00CN, OP_00DN, OP_00FB, OP_00FC, OP_00FD, OP_00FE, OP_00FF, // SUPER-CHIP and XO-CHIP
+    OP_5XY2, OP_5XY3, OP_FN01, OP_FX30, OP_FX75, OP_FX85,
+    OP_8XY1_VF, OP_8XY2_VF, OP_8XY3_VF, OP_8XY6_VY, OP_8XYE_VY, // The other reading of an instruction with a quirk, see quirks.h
+    OP_BXNN, OP_FX55_I, OP_FX65_I,
+    OPS                                 // Number of handlers
+};
+
+typedef struct Insn                     // begin predecoded instruction struct
+{
+
+    unsigned char op;                   // Handler to run
+    unsigned char x;                    // X, bits 8-11 of the opcode
+    unsigned char y;                    // Y, bits 4-7 of the opcode
+    unsigned char nn;                   // NN, the low byte of the opcode
+    unsigned short int opcode;          // The whole opcode, NNN and N are masked out of it
+
+}INSN;                                  // end predecoded instruction struct
 
 
 typedef struct Chip8                    // begin emulator struct
@@ -40,30 +78,78 @@ typedef struct Chip8                    // begin emulator struct
     unsigned char V[REGISTER];          // CPU register
     unsigned short int I;               // Index register
     unsigned short int pc;              // Program counter
-    unsigned char graphics[GRAPHICS];        // Graphics of Chip 8. 2048 pixels(64x32) black and white
+    uint64_t graphics[PLANES][HIRES_H][2]; // Graphics of Chip 8. Per plane, a row of two words, leftmost pixel in the top bit of the first. 64x32 only uses the first word of the first 32 rows
     unsigned char delay_timer;          // Count at 60Hz
     unsigned char sound_timer;          // When the time gets to 0, it buzzer a sound
+    unsigned int ipf;                   // Instructions per 60 Hz frame, the timers tick once every that many
+    unsigned int tick;                  // Instructions run since they last ticked
     unsigned short int stack[STACKS];   // To remember the current location before a jump, has 16 levels
     unsigned short int ps;              // A pointer to the current location at the stack
     unsigned char key[KEYNUM];          // CHIP 8 has 16 commands
-    FILE *rom;                          // To open the game
+    unsigned char draw;                 // Set by the CPU when the screen must be redrawn
+    unsigned char hires;                // Set in the 128x64 mode of SUPER-CHIP, 00FF
+    unsigned char planes;               // Bitplanes drawn, cleared and scrolled, bit N for plane N. XO-CHIP's FN01, 1 otherwise
+    unsigned char flags[REGISTER];      // SUPER-CHIP's user flags, FX75 and FX85
+    unsigned char quirks;               // QUIRK_ bits of quirks.h the instructions were decoded for
+    unsigned long unknown;              // Unknown opcodes run since the game was loaded. PC stays on one, so a count that keeps growing is a stuck machine
+    uint32_t random;                    // State of the random number generator of CXNN
+    uint64_t dirty;                     // Pages of memory written since the last save_state() or restore_state() of base
+    const struct State *base;           // The state the dirty pages are relative to, NULL when none
+    unsigned long stamp;                // Stamp base had then
+    INSN decoded[MEMOSZ];               // Instruction cache, the predecoded instruction at every address
+    struct Blocks *blocks;              // Basic block cache of run_blocks(), NULL until it is used
+    struct Profile *profile;            // Counters of profile.c, NULL when not profiling
+    struct Trace *trace;                // Ring of trace.c, NULL when not tracing
+    struct Audio *audio;                // Beeper of audio.c, NULL when silent
 
 }CH;                                    // end emulator struct
 
 
+#define PLANE_PIXEL(C8, p, x, y) (((C8)->graphics[p][y][(x) >> 6] >> (63 - ((x) & 63))) & 1) // The pixel at x, y of a plane, 1 when it is on
+#define PIXEL(C8, x, y) PLANE_PIXEL(C8, 0, x, y)
+
+
 /*
  * Memory Map
  * 0x000 - 0x1FF - Chip 8 interpreter
- * 0x050 - 0x0A0 - Used for the built in 4x5 pixel font set (0-F)
+ * 0x000 - 0x04F - Used for the built in 4x5 pixel font set (0-F)
+ * 0x050 - 0x0EF - And the 8x10 one of SUPER-CHIP and XO-CHIP (0-F)
  * 0x200 - 0xFFF - Program ROM and work RAM
  */
 
 
-void prepare_emulator(CH *, char *);  // To reset everything, pass the font and game to the memory of the emulator
-void cycles(CH *);                    // The cycles of the CPU
-void render(CH *);                    // To render the graphics
-void start();                         // To input the game
-void initalize(char *);               // To initialize the game
+extern void (*const handlers[OPS])(CH *, const INSN *); // Instruction handlers, indexed by INSN.op
+extern unsigned int ipf;              // Instructions per frame prepare_emulator() gives an instance
+
+int prepare_emulator(CH *, char *);   // To reset everything, pass the font and game to the memory of the emulator. Returns -1 if the game can't be loaded
+int load_game(CH *, const unsigned char *, size_t, const INSN *); // The same from a game of that many bytes in memory. The instruction cache is copied from the last argument unless it's NULL. Returns -1 if the game is too big
+int boot_game(CH *, const unsigned char *, size_t, const INSN *, unsigned int, unsigned char); // load_game() with the instructions per frame and the quirks given, not taken from the command line
+void unload_game(CH *);               // Free the block cache, profile and trace of an instance loaded before, to load it again. The audio is the window's, close_audio() it
+void seed_random(CH *, uint32_t);     // Restart the random numbers of CXNN from a seed, to replay a run
+uint32_t next_random(CH *);           // Next random number of an instance
+unsigned char draw_sprite(CH *, unsigned int, unsigned int, unsigned int, unsigned short int); // XOR a sprite at x, y of a given height from an address into the selected planes, as DXYN. Height 0 is 16x16. Returns 1 on collision
+void decode_insn(CH *, unsigned short int); // Decode the instruction at an address into the instruction cache
+void decode_memory(CH *);             // Fill the instruction cache from the whole memory
+void invalidate_memory(CH *, unsigned short int, int); // Memory at an address was written: drop what was decoded from it and mark it dirty
+void set_quirks(CH *, unsigned char);  // Switch an instance to other quirks, decoding its memory again when they differ
+void cycles(CH *);                    // The cycles of the CPU, one instruction per call
+void run_cycles(CH *, unsigned long); // Run that many cycles back to back
+void run_frame(CH *);                 // Run up to the next tick of the timers, one 60th of a second of the machine
+void tick_timers(CH *);               // Count the timers down once, as 60 Hz does
+void pass_cycles(CH *, unsigned long); // Let that many cycles go by without running anything but the timers
+unsigned long skip_idle(CH *, unsigned long); // Fast-forward an idle wait at PC within a budget. Returns the cycles it stood for, 0 when PC is not in one
+int sleeping(CH *);                   // 1 when nothing can happen until a key is pressed: waiting in FX0A with the timers stopped
+
+static inline void run_insn(CH *C8, const INSN *in)    // One step of the run loops: run a decoded instruction and count it toward the next tick. For loops outside chip8.c
+{
+    C8->opcode = in->opcode;
+    handlers[in->op](C8, in);
+
+    if(++C8->tick >= C8->ipf){                          // The timers run at 60 Hz of the machine, not at the rate of the CPU
+        C8->tick = 0;
+        tick_timers(C8);
+    }
+}
 
 
 #endif // CHIP8_H_INCLUDED
@@ -0,0 +1,508 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+/*
+ * Conformance of the execution engines, with a main of its own:
+ *
+ *   cc -O2 -o chip8_conform conform.c chip8.c block.c display.c lanes.c state.c batch.c profile.c pack.c trace.c quirks.c -lpthread
+ *   chip8_conform [-f F] [-every N] [-seed S] [-threads T] [-m manifest] [game ...]
+ *
+ * Every game, and every session of the manifest with its input recording,
+ * runs F frames (600 by default) through the reference, cycles() one
+ * instruction at a time, and through each faster engine: run_cycles()
+ * with its idle skipping, the block cache and the lockstep lanes. Random
+ * numbers come from seed S (1), and S + 1 for every other lane, so the
+ * lanes split and join again. Every N frames (60) the memory, screen,
+ * registers, stack and timers of each engine are hashed and compared with
+ * the reference. At the first checkpoint that differs both go back to the
+ * last one that agreed, and halving the distance finds the first
+ * instruction after which they differ. The sessions are shared out over
+ * T threads, one per core by default. Before any of that a few small
+ * built-in games are traced and replayed, each one a trace that once
+ * failed to replay. The exit status is 1 when any engine diverged or a
+ * trace didn't replay.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "chip8.h"
+#include "block.h"
+#include "lanes.h"
+#include "state.h"
+#include "batch.h"
+#include "pack.h"
+#include "trace.h"
+
+#define SEEDS 2                                     // Distinct random seeds among the instances of a run
+
+struct Run;
+
+typedef struct Engine                               // begin engine struct
+{
+
+    const char *name;
+    int instances;                                  // CHs it runs side by side
+    void (*run)(struct Run *, unsigned long);       // Run every instance that many instructions
+
+}ENGINE;                                            // end engine struct
+
+typedef struct Run                                  // begin engine run struct
+{
+
+    const ENGINE *engine;
+    CH *C8[LANES];
+    STATE *good[LANES];                             // Each instance at the last checkpoint that agreed
+    LOCKSTEP *lockstep;                             // For the lanes, NULL for the others
+    const SESSION *session;                         // The game and its recording
+    int next;                                       // Next key event of the recording
+    unsigned long executed;                         // Instructions run by every instance
+    int goodnext;                                   // The same two at the last checkpoint
+    unsigned long goodexecuted;
+    int diverged;
+
+}RUN;                                               // end engine run struct
+
+typedef struct Job                                  // begin conformance job struct
+{
+
+    SESSION *sessions;
+    char **names;
+    int count;
+    atomic_int taken;                               // Next session to check
+    atomic_int failures;
+    pthread_mutex_t print;                          // One report at a time
+
+}JOB;                                               // end conformance job struct
+
+static unsigned long frames = 600, every = 60;
+static uint32_t seed = 1;
+
+static void run_reference(RUN *R, unsigned long n)
+{
+    unsigned long k;
+    int i;
+    for(i = 0; i < R->engine->instances; i++)
+        for(k = 0; k < n; k++)
+            cycles(R->C8[i]);
+}
+
+static void run_idle(RUN *R, unsigned long n)
+{
+    run_cycles(R->C8[0], n);
+}
+
+static void run_cached(RUN *R, unsigned long n)
+{
+    run_blocks(R->C8[0], n);
+}
+
+static void run_lanes(RUN *R, unsigned long n)      // The lanes are loaded every time, keys and restored states go through the CHs
+{
+    load_lockstep(R->lockstep, R->C8);
+    run_lockstep(R->lockstep, n);
+    store_lockstep(R->lockstep);
+}
+
+typedef struct TraceCheck                           // begin trace check struct
+{
+
+    const char *name;
+    unsigned char rom[32];
+    size_t size;
+    unsigned short int keys;                        // Held from the start
+    unsigned long n;                                // Instructions traced
+
+}TRACECHECK;                                        // end trace check struct
+
+static const TRACECHECK tracechecks[] =             // Small games a trace once failed to replay
+{
+    { "EX9E takes the key", { 0xE0, 0x9E, 0x12, 0x06, 0x71, 0x01, 0xE0, 0x9E, 0x12, 0x0C, 0x72, 0x01, 0x12, 0x0C }, 14, 0x0001, 6 },
+    { "Writes wrap past 0xFFF", { 0xAF, 0xFE, 0x60, 0xFF, 0xF0, 0x33, 0xF2, 0x55, 0x50, 0x22, 0x12, 0x0A }, 12, 0x0000, 8 },
+};
+
+static const ENGINE reference = { "cycles", SEEDS, run_reference };
+static const ENGINE engines[] =
+{
+    { "run_cycles", 1, run_idle },
+    { "run_blocks", 1, run_cached },
+    { "lockstep", LANES, run_lanes }
+};
+#define ENGINES ((int)(sizeof(engines) / sizeof(engines[0])))
+
+static uint64_t hash_instance(const CH *C8)         // Everything the engines have to agree on
+{
+    uint64_t h = 0xCBF29CE484222325ULL, w;
+    int i;
+
+    for(i = 0; i < MEMOSZ; i += 8)
+    {
+        memcpy(&w, &C8->memory[i], 8);
+        h = (h ^ w) * 0x100000001B3ULL;
+    }
+    for(i = 0; i < PLANES * HIRES_H; i++)                   // Every plane, row after row
+        h = (h ^ C8->graphics[i / HIRES_H][i % HIRES_H][0] ^ C8->graphics[i / HIRES_H][i % HIRES_H][1] << 1) * 0x100000001B3ULL;
+    h = (h ^ C8->hires ^ C8->planes << 1) * 0x100000001B3ULL;
+    for(i = 0; i < REGISTER; i++)
+        h = (h ^ C8->V[i] ^ C8->flags[i] << 8) * 0x100000001B3ULL;
+    for(i = 0; i < STACKS; i++)
+        h = (h ^ C8->stack[i]) * 0x100000001B3ULL;
+    h = (h ^ C8->I) * 0x100000001B3ULL;
+    h = (h ^ C8->pc) * 0x100000001B3ULL;
+    h = (h ^ C8->ps) * 0x100000001B3ULL;
+    h = (h ^ C8->delay_timer) * 0x100000001B3ULL;
+    h = (h ^ C8->sound_timer) * 0x100000001B3ULL;
+    h = (h ^ C8->tick) * 0x100000001B3ULL;
+    return h;
+}
+
+static void set_keys(CH *C8, unsigned short int keys)
+{
+    int i;
+    for(i = 0; i < KEYNUM; i++)
+        C8->key[i] = (keys >> i) & 1;
+}
+
+static void advance(RUN *R, unsigned long n)        // Run n instructions, changing keys on the exact instruction the recording says
+{
+    const SESSION *S = R->session;
+    unsigned long k;
+    int i;
+
+    while(n > 0)
+    {
+        while(R->next < S->nevents && S->events[R->next].at <= R->executed)
+        {
+            for(i = 0; i < R->engine->instances; i++)
+                set_keys(R->C8[i], S->events[R->next].keys);
+            R->next++;
+        }
+        k = n;
+        if(R->next < S->nevents && k > S->events[R->next].at - R->executed)
+            k = S->events[R->next].at - R->executed;
+        R->engine->run(R, k);
+        R->executed += k;
+        n -= k;
+    }
+}
+
+static int open_run(RUN *R, const ENGINE *E, const SESSION *S)
+{
+    int i;
+
+    memset(R, 0, sizeof(RUN));
+    R->engine = E;
+    R->session = S;
+    if(E->instances == LANES && (R->lockstep = malloc(sizeof(LOCKSTEP))) == NULL)
+        return -1;
+    for(i = 0; i < E->instances; i++)
+    {
+        if((R->C8[i] = malloc(sizeof(CH))) == NULL || (R->good[i] = malloc(sizeof(STATE))) == NULL)
+            return -1;
+        *R->C8[i] = S->C8;                          // The game as the session loaded it, caches and all
+        seed_random(R->C8[i], seed + i % SEEDS);
+        save_state(R->C8[i], R->good[i]);
+    }
+    return 0;
+}
+
+static void close_run(RUN *R)
+{
+    int i;
+    for(i = 0; i < LANES; i++)
+    {
+        if(R->C8[i] != NULL)
+            free_blocks(R->C8[i]);
+        free(R->C8[i]);
+        free(R->good[i]);
+    }
+    free(R->lockstep);
+}
+
+static void keep(RUN *R)                            // This checkpoint agreed, it's where a search starts from now
+{
+    int i;
+    for(i = 0; i < R->engine->instances; i++)
+        save_state(R->C8[i], R->good[i]);
+    R->goodnext = R->next;
+    R->goodexecuted = R->executed;
+}
+
+static void back(RUN *R)                            // To the last checkpoint that agreed
+{
+    int i;
+    for(i = 0; i < R->engine->instances; i++)
+        restore_state(R->C8[i], R->good[i]);
+    R->next = R->goodnext;
+    R->executed = R->goodexecuted;
+}
+
+static int differs(RUN *ref, RUN *R)                // First instance that doesn't match the reference with the same seed, -1 when all do
+{
+    int i;
+    for(i = 0; i < R->engine->instances; i++)
+        if(hash_instance(R->C8[i]) != hash_instance(ref->C8[i % SEEDS]))
+            return i;
+    return -1;
+}
+
+static void show(FILE *out, const char *what, const CH *C8)
+{
+    int i;
+    fprintf(out, "    %-10s pc 0x%03X I 0x%03X delay %3d sound %3d ps %2d tick %u V", what, C8->pc, C8->I, C8->delay_timer, C8->sound_timer, C8->ps, C8->tick);
+    for(i = 0; i < REGISTER; i++)
+        fprintf(out, " %02X", C8->V[i]);
+    fprintf(out, "\n");
+}
+
+static void report(JOB *J, const char *name, RUN *ref, RUN *R, unsigned long span) // Find the first instruction after which R differs and say so
+{
+    unsigned long lo = 0, hi = span, mid;              // Agree after lo instructions, differ after hi
+    unsigned short int pc;
+    int lane;
+
+    while(hi - lo > 1)
+    {
+        mid = lo + (hi - lo) / 2;
+        back(ref);
+        back(R);
+        advance(ref, mid);
+        advance(R, mid);
+        if(differs(ref, R) < 0)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    back(ref);                                      // Where the instruction was, then both where they differ, each in one go from the checkpoint like the search
+    advance(ref, lo);
+    pc = ref->C8[0]->pc & 0xFFF;
+    back(ref);
+    back(R);
+    advance(ref, hi);
+    advance(R, hi);
+    lane = differs(ref, R);
+
+    pthread_mutex_lock(&J->print);
+    printf("%s: %s diverges at instruction %lu (frame %lu), running 0x%04X at 0x%03X", name, R->engine->name,
+           R->goodexecuted + hi, (R->goodexecuted + hi - 1) / ref->C8[0]->ipf,
+           ref->C8[0]->memory[pc] << 8 | ref->C8[0]->memory[(pc + 1) & 0xFFF], pc);
+    if(R->engine->instances > 1 && lane >= 0)
+        printf(" in lane %d", lane);
+    printf("\n");
+    if(lane >= 0){
+        show(stdout, reference.name, ref->C8[lane % SEEDS]);
+        show(stdout, R->engine->name, R->C8[lane]);
+        if(memcmp(ref->C8[lane % SEEDS]->graphics, R->C8[lane]->graphics, sizeof(R->C8[lane]->graphics)) != 0)
+            printf("    the screens differ\n");
+        if(memcmp(ref->C8[lane % SEEDS]->memory, R->C8[lane]->memory, MEMOSZ) != 0)
+            printf("    the memories differ\n");
+    }
+    pthread_mutex_unlock(&J->print);
+}
+
+static void check(JOB *J, int s)                    // Every engine against the reference, one session
+{
+    RUN ref, runs[ENGINES];
+    unsigned long done, span, total;
+    int e, failed = 0;
+
+    if(open_run(&ref, &reference, &J->sessions[s]) != 0){
+        close_run(&ref);
+        return;
+    }
+    for(e = 0; e < ENGINES; e++)
+        if(open_run(&runs[e], &engines[e], &J->sessions[s]) != 0){
+            while(e >= 0)                           // The one that failed may be half open too
+                close_run(&runs[e--]);
+            close_run(&ref);
+            return;
+        }
+
+    total = frames * ref.C8[0]->ipf;
+    for(done = 0; done < total; done += span)
+    {
+        span = every * ref.C8[0]->ipf;
+        if(span > total - done)
+            span = total - done;
+        advance(&ref, span);
+        for(e = 0; e < ENGINES; e++)
+        {
+            if(runs[e].diverged)
+                continue;
+            advance(&runs[e], span);
+            if(differs(&ref, &runs[e]) < 0){
+                keep(&runs[e]);
+                continue;
+            }
+            report(J, J->names[s], &ref, &runs[e], span);
+            runs[e].diverged = 1;
+            failed = 1;
+            back(&ref);                             // The search moved the reference, put it at this checkpoint again
+            advance(&ref, span);
+        }
+        keep(&ref);
+    }
+
+    pthread_mutex_lock(&J->print);
+    if(!failed)
+        printf("%s: %d engines agree with %s over %lu frames\n", J->names[s], ENGINES, reference.name, frames);
+    pthread_mutex_unlock(&J->print);
+    if(failed)
+        atomic_fetch_add(&J->failures, 1);
+    for(e = 0; e < ENGINES; e++)
+        close_run(&runs[e]);
+    close_run(&ref);
+}
+
+static int check_traces(void)                       // Trace each of them and replay it, the number that didn't replay
+{
+    char path[64];
+    unsigned long matched;
+    CH *C8 = calloc(1, sizeof(CH));
+    int i, failures = 0;
+
+    if(C8 == NULL)
+        return 1;
+    snprintf(path, sizeof(path), "/tmp/chip8_conform_%d.trace", (int)getpid());
+    for(i = 0; i < (int)(sizeof(tracechecks) / sizeof(tracechecks[0])); i++)
+    {
+        const TRACECHECK *T = &tracechecks[i];
+        load_game(C8, T->rom, T->size, NULL);
+        set_keys(C8, T->keys);
+        if(start_trace(C8, path) == NULL){
+            printf("trace \"%s\": can't write %s\n", T->name, path);
+            failures++;
+            continue;
+        }
+        run_cycles(C8, T->n);
+        stop_trace(C8);
+        if(replay_trace(path, &matched) != 0 || matched != T->n){
+            printf("trace \"%s\": replayed %lu of %lu instructions\n", T->name, matched, T->n);
+            failures++;
+        }
+        remove(path);
+    }
+    free(C8);
+    return failures;
+}
+
+static void *work(void *arg)
+{
+    JOB *J = arg;
+    int s;
+    while((s = atomic_fetch_add(&J->taken, 1)) < J->count)
+        check(J, s);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    JOB J;
+    SESSION *sessions = NULL, *loaded, *grown;
+    char **names = NULL, *manifest = NULL;
+    int count = 0, threads = 0, i, n, traced, named;
+    pthread_t *pool;
+
+    for(i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+            frames = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "-every") == 0 && i + 1 < argc)
+            every = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "-seed") == 0 && i + 1 < argc)
+            seed = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "-threads") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-ipf") == 0 && i + 1 < argc)
+            ipf = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+            manifest = argv[++i];
+        else
+        {
+            if((grown = realloc(sessions, (count + 1) * sizeof(SESSION))) == NULL)
+                return 1;
+            sessions = grown;
+            memset(&sessions[count], 0, sizeof(SESSION));
+            if(prepare_game(&sessions[count].C8, argv[i]) != 0)
+                continue;
+            names = realloc(names, (count + 1) * sizeof(char *));
+            names[count++] = argv[i];
+        }
+    }
+    named = count;                                  // Names from here on are allocated
+    if(manifest != NULL && (n = load_sessions(manifest, &loaded, 0)) > 0)
+    {
+        if((grown = realloc(sessions, (count + n) * sizeof(SESSION))) == NULL)
+            return 1;
+        sessions = grown;
+        memcpy(&sessions[count], loaded, n * sizeof(SESSION));
+        free(loaded);
+        names = realloc(names, (count + n) * sizeof(char *));
+        for(i = 0; i < n; i++)                      // The manifest's sessions go by their number
+        {
+            names[count + i] = malloc(strlen(manifest) + 16);
+            sprintf(names[count + i], "%s #%d", manifest, i + 1);
+        }
+        count += n;
+    }
+    n = sizeof(tracechecks) / sizeof(tracechecks[0]);
+    traced = check_traces();
+    printf("%d traces, %d failed to replay\n", n, traced);
+    if(count == 0){
+        printf("Usage: %s [-f frames] [-every frames] [-seed seed] [-threads threads] [-m manifest] [game ...]\n", argv[0]);
+        return traced > 0;
+    }
+    if(every < 1)
+        every = 1;
+
+    J.sessions = sessions;
+    J.names = names;
+    J.count = count;
+    atomic_init(&J.taken, 0);
+    atomic_init(&J.failures, 0);
+    pthread_mutex_init(&J.print, NULL);
+    if(threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(threads <= 0)
+        threads = 1;
+    if(threads > count)
+        threads = count;
+
+    pool = malloc(threads * sizeof(pthread_t));
+    for(i = 1; i < threads; i++)                    // The calling thread is one of them
+        pthread_create(&pool[i], NULL, work, &J);
+    work(&J);
+    for(i = 1; i < threads; i++)
+        pthread_join(pool[i], NULL);
+
+    printf("%d sessions, %d diverged\n", count, atomic_load(&J.failures));
+    pthread_mutex_destroy(&J.print);
+    free(pool);
+    free_sessions(sessions, count);
+    for(i = named; i < count; i++)
+        free(names[i]);
+    free(names);
+    return atomic_load(&J.failures) > 0 || traced > 0;
+}
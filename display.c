@@ -0,0 +1,125 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+
+#include <stdint.h>
+#include <string.h>
+#include "chip8.h"
+#include "display.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+void clear_graphics(uint64_t *plane, int rows)
+{
+    int i;
+#if defined(__AVX2__)
+    __m256i zero = _mm256_setzero_si256();
+    for(i = 0; i < 2 * rows; i += 4)                        // Two rows a store
+        _mm256_storeu_si256((__m256i *)&plane[i], zero);
+#elif defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    for(i = 0; i < 2 * rows; i += 2)
+        _mm_storeu_si128((__m128i *)&plane[i], zero);
+#else
+    for(i = 0; i < 2 * rows; i++)
+        plane[i] = 0;
+#endif
+}
+
+uint64_t diff_graphics(const uint64_t *a, const uint64_t *b, int rows)
+{
+    uint64_t diff = 0;
+    int p, y;
+#if defined(__AVX2__)
+    int m;
+    for(p = 0; p < PLANES; p++, a += PLANEWORDS, b += PLANEWORDS)
+        for(y = 0; y < rows; y += 2)                        // Two rows per compare, one mask bit per word
+        {
+            __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *)&a[2 * y]),
+                                            _mm256_loadu_si256((const __m256i *)&b[2 * y]));
+            m = ~_mm256_movemask_pd(_mm256_castsi256_pd(eq)) & 0xF;
+            diff |= (uint64_t)(((m & 0x3) != 0) | ((m & 0xC) != 0) << 1) << y;
+        }
+#elif defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    for(p = 0; p < PLANES; p++, a += PLANEWORDS, b += PLANEWORDS)
+        for(y = 0; y < rows; y++)                           // A row per compare
+        {
+            __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&a[2 * y]),
+                                      _mm_loadu_si128((const __m128i *)&b[2 * y]));
+            diff |= (uint64_t)(_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) != 0xFFFF) << y;
+        }
+#else
+    for(p = 0; p < PLANES; p++, a += PLANEWORDS, b += PLANEWORDS)
+        for(y = 0; y < rows; y++)
+            if(a[2 * y] != b[2 * y] || a[2 * y + 1] != b[2 * y + 1])
+                diff |= (uint64_t)1 << y;
+#endif
+    return diff;
+}
+
+#define LUT(b, k) (((b) & (0x80 >> (k))) ? PIXEL_ON : PIXEL_OFF) // Pixel k of byte b
+#define LUT_ROW(b) { LUT(b, 0), LUT(b, 1), LUT(b, 2), LUT(b, 3), LUT(b, 4), LUT(b, 5), LUT(b, 6), LUT(b, 7) }
+#define COLOUR(first, second) ((first) ? ((second) ? PIXEL_BOTH : PIXEL_ON) : ((second) ? PIXEL_TWO : PIXEL_OFF))
+#define BLEND(b, k) COLOUR(((b) >> (3 - (k))) & 1, ((b) >> (7 - (k))) & 1) // Pixel k of a nibble of each plane, the second one in the high bits of b
+#define BLEND_ROW(b) { BLEND(b, 0), BLEND(b, 1), BLEND(b, 2), BLEND(b, 3) }
+#define BYTES4(row, b) row(b), row((b) + 1), row((b) + 2), row((b) + 3)
+#define BYTES16(row, b) BYTES4(row, b), BYTES4(row, (b) + 4), BYTES4(row, (b) + 8), BYTES4(row, (b) + 12)
+#define BYTES64(row, b) BYTES16(row, b), BYTES16(row, (b) + 16), BYTES16(row, (b) + 32), BYTES16(row, (b) + 48)
+#define BYTES256(row) BYTES64(row, 0), BYTES64(row, 64), BYTES64(row, 128), BYTES64(row, 192)
+
+static const uint32_t lut[256][8] = { BYTES256(LUT_ROW) };          // The eight ARGB pixels of every byte of a row of the first plane alone. Built by the compiler, so threads share it for free
+static const uint32_t blend[256][4] = { BYTES256(BLEND_ROW) };      // The four of a nibble of each plane, the second one in the high bits
+
+static void expand_word(uint32_t *pixels, uint64_t first, uint64_t second) // 64 pixels of a row
+{
+    int b;
+    if(second == 0)                                         // Plain CHIP-8, a byte at a time
+        for(b = 0; b < 8; b++)
+            memcpy(&pixels[b * 8], lut[(first >> (56 - 8 * b)) & 0xFF], sizeof(lut[0]));
+    else                                                    // A nibble of each plane at a time
+        for(b = 0; b < 16; b++)
+            memcpy(&pixels[b * 4], blend[((first >> (60 - 4 * b)) & 0xF) | ((second >> (60 - 4 * b)) & 0xF) << 4], sizeof(blend[0]));
+}
+
+uint64_t expand_graphics(uint32_t *pixels, uint64_t *shown, const uint64_t *graphics, int hires)
+{
+    int rows = hires ? HIRES_H : H, words = hires ? 2 : 1, y, k, p;
+    uint64_t diff = diff_graphics(shown, graphics, rows);
+    const uint64_t *second = graphics + PLANEWORDS;
+
+    for(y = 0; y < rows; y++)
+    {
+        if(!(diff & ((uint64_t)1 << y)))
+            continue;
+        for(k = 0; k < words; k++)
+        {
+            expand_word(&pixels[y * HIRES_W + k * 64], graphics[2 * y + k], second[2 * y + k]);
+            for(p = 0; p < PLANES; p++)                     // Only the words expanded: the right half stays unseen in 64x32
+                shown[p * PLANEWORDS + 2 * y + k] = graphics[p * PLANEWORDS + 2 * y + k];
+        }
+    }
+    return diff;
+}
@@ -0,0 +1,53 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef DISPLAY_H_INCLUDED
+#define DISPLAY_H_INCLUDED
+
+#include <stdint.h>
+#include "chip8.h"
+
+#define PIXEL_ON 0xFFFFFFFF                                // ARGB colour of a pixel that is on
+#define PIXEL_OFF 0xFF000000                               // And off
+#define PIXEL_TWO 0xFF808080                               // On in the second plane of XO-CHIP only
+#define PIXEL_BOTH 0xFFC0C0C0                              // On in both
+#define PLANEWORDS (HIRES_H * 2)                           // Words of a plane of CH.graphics
+
+
+/*
+ * Whole-screen operations on the packed framebuffer of CH.graphics: PLANES
+ * planes of HIRES_H rows of two 64-bit words each, passed flat. They only
+ * look at the rows of the mode the machine is in, so the 64x32 screen costs
+ * what it did before the 128x64 one came. They use AVX2 or SSE2 when the
+ * compiler targets them (-mavx2, SSE2 is always there on x86-64) and plain
+ * words otherwise.
+ *
+ * expand_graphics() is the software side of the renderer: it needs no SDL,
+ * so a headless host can produce the same ARGB frames as the window.
+ */
+
+
+void clear_graphics(uint64_t *, int);                     // Turn every pixel of the first rows of a plane off
+uint64_t diff_graphics(const uint64_t *, const uint64_t *, int); // Rows among the first ones that differ between two screens in any plane, bit y set for row y
+uint64_t expand_graphics(uint32_t *, uint64_t *, const uint64_t *, int); // Update an ARGB copy of a screen, HIRES_W pixels a row, and its shadow to a new screen, only the rows that changed. 64x32 unless the last argument is set. Returns the rows
+
+
+#endif // DISPLAY_H_INCLUDED
@@ -0,0 +1,497 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+/*
+ * Coverage-guided exploration of a game, with a main of its own:
+ *
+ *   cc -O2 -o chip8_explore explore.c chip8.c block.c display.c profile.c pack.c trace.c state.c quirks.c batch.c -lpthread
+ *   chip8_explore [-f F] [-t seconds] [-x runs] [-seed S] [-o dir] [-r recording] game
+ *
+ * The corpus starts with the game just loaded. A run picks an entry,
+ * restores the machine it left (a STATE in memory, so only the pages
+ * that differ are copied back) and plays F frames (60 by default) of
+ * generated keys from there: random keys held for random times. A run
+ * that reaches an address or a branch no run reached before is kept,
+ * with the state it ended in, so later runs go on from further into the
+ * game. A branch is any step to somewhere other than the next
+ * instruction, taken skips, jumps, calls and returns, hashed by where it
+ * came from and where it went. The summary at the end also names every
+ * handler the runs reached.
+ *
+ * Before it runs, every instruction that can go wrong is checked, and a
+ * run stops at the first that would: a call with the stack full, a
+ * return with it empty, or DXYN, FX33, FX55, FX65, 5XY2 or 5XY3 reaching
+ * past the end of memory. An opcode no interpreter knows runs, and stops
+ * the run once CH.unknown has counted it. Each kind of crash is reported
+ * once per address.
+ *
+ * It runs for T seconds (10) or X runs, whichever comes first, one core
+ * at a time: run one per core with different seeds. With -o, every crash
+ * is written to the directory as it is found, and the corpus at the end,
+ * each as an input recording of batch.c with a manifest of the corpus.
+ * -r runs a recording again from the start with the same seed and
+ * reports the crash it finds.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "chip8.h"
+#include "state.h"
+#include "batch.h"
+#include "pack.h"
+#include "profile.h"
+
+#define EDGES (1 << 16)                     // Slots of the branch map, a bit each
+#define CORPUS 4096                         // Most entries kept, each holding a STATE
+#define HOLD 20                             // Most frames a generated key is held
+
+enum                                        // What a run stopped on
+{
+    CRASH_NONE,
+    CRASH_OVERFLOW,
+    CRASH_UNDERFLOW,
+    CRASH_SPRITE,
+    CRASH_MEMORY,
+    CRASH_UNKNOWN,
+    CRASHES
+};
+
+static const char *const crash_names[CRASHES] =
+{
+    "none", "stack overflow", "stack underflow", "sprite past memory", "I past memory", "unknown opcode"
+};
+
+static const unsigned char risky[OPS] =     // Instructions checked before they run
+{
+    [OP_00EE] = 1, [OP_2NNN] = 1, [OP_DXYN] = 1, [OP_FX33] = 1,
+    [OP_FX55] = 1, [OP_FX65] = 1, [OP_FX55_I] = 1, [OP_FX65_I] = 1, [OP_5XY2] = 1, [OP_5XY3] = 1
+};
+
+typedef struct Entry                        // begin corpus entry struct
+{
+
+    STATE *state;                           // The machine at the end of the input, where runs from this entry start
+    KEYEVENT *events;                       // The input, from the start of the game
+    int nevents;
+    unsigned long at;                       // Instructions from the start of the game to the state
+    unsigned long picks;                    // Runs started from it
+    int depth;                              // Entries before it, the first being 0
+
+}ENTRY;                                     // end corpus entry struct
+
+typedef struct Explorer                     // begin explorer struct
+{
+
+    CH C8;
+    ENTRY corpus[CORPUS];
+    int count;
+    unsigned char seen[MEMOSZ];             // Set for every address that ran
+    uint64_t edges[EDGES / 64];             // Set for every branch taken
+    unsigned char ops[OPS];                 // Set for every handler that ran
+    unsigned char crashed[CRASHES][MEMOSZ]; // Set for every crash found, by kind and address
+    unsigned short int prev;                // Address of the last instruction run
+    unsigned long found;                    // Addresses and branches the current run reached first
+    unsigned long addresses;
+    unsigned long branches;
+    unsigned long runs;
+    unsigned long instructions;
+    int crashes;
+    uint32_t random;
+    KEYEVENT *input;                        // The current run's input: its entry's, then what is generated
+    int ninput;
+    int size;
+    unsigned long span;                     // Instructions a run lasts
+    char *game;
+    char *out;                              // Directory the crashes and the corpus go to, NULL for none
+
+}EXPLORER;                                  // end explorer struct
+
+static double seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t rnd(EXPLORER *E)                            // Xorshift32, apart from the machine's own
+{
+    uint32_t r = E->random;
+    r ^= r << 13;
+    r ^= r >> 17;
+    r ^= r << 5;
+    return E->random = r;
+}
+
+static void set_keys(CH *C8, unsigned short int keys)
+{
+    int i;
+    for(i = 0; i < KEYNUM; i++)
+        C8->key[i] = (keys >> i) & 1;
+}
+
+static int crash_of(CH *C8, const INSN *in)                 // What the instruction would do wrong, CRASH_NONE if nothing
+{
+    unsigned int bytes;
+
+    switch(in->op)
+    {
+        case OP_2NNN:
+            return C8->ps >= STACKS ? CRASH_OVERFLOW : CRASH_NONE;
+        case OP_00EE:
+            return C8->ps == 0 ? CRASH_UNDERFLOW : CRASH_NONE;
+        case OP_DXYN:                                       // N rows of a byte, or 16 of two, for every plane drawn
+            bytes = (in->opcode & 0x000F) != 0 ? (in->opcode & 0x000F) : 32;
+            bytes *= (C8->planes & 1) + (C8->planes >> 1 & 1);
+            return bytes > 0 && C8->I + bytes > MEMOSZ ? CRASH_SPRITE : CRASH_NONE;
+        case OP_FX33:
+            bytes = 3;
+            break;
+        case OP_5XY2: case OP_5XY3:
+            bytes = (in->x > in->y ? in->x - in->y : in->y - in->x) + 1;
+            break;
+        default:                                            // FX55 and FX65, either reading
+            bytes = in->x + 1;
+    }
+    return C8->I + bytes > MEMOSZ ? CRASH_MEMORY : CRASH_NONE;
+}
+
+static int run_span(EXPLORER *E, unsigned long n, unsigned long *done) // run_cycles() with the coverage taken and every risky instruction checked. Returns the crash it stopped on, with done the instructions run before it
+{
+    CH *C8 = &E->C8;
+    const INSN *in;
+    unsigned short int pc, prev = E->prev;
+    unsigned long left = n, idle, unknown = C8->unknown;
+    unsigned int edge;
+    unsigned char op;
+    int kind = CRASH_NONE;
+
+    while(left > 0)
+    {
+        pc = C8->pc & 0xFFF;
+        in = &C8->decoded[pc];
+        if(in->op == OP_DECODE)
+            decode_insn(C8, pc);
+        op = in->op;
+        if(!E->seen[pc]){
+            E->seen[pc] = 1;
+            E->ops[op] = 1;
+            E->addresses++;
+            E->found++;
+        }
+        if(pc != ((prev + 2) & 0xFFF)){                     // Somewhere else than the next instruction
+            edge = ((unsigned int)prev << 4 ^ pc) & (EDGES - 1);
+            if(!(E->edges[edge >> 6] >> (edge & 63) & 1)){
+                E->edges[edge >> 6] |= (uint64_t)1 << (edge & 63);
+                E->branches++;
+                E->found++;
+            }
+        }
+        prev = pc;
+        if(risky[op] && (kind = crash_of(C8, in)) != CRASH_NONE)
+            break;
+        if((unsigned char)(op - OP_WAIT) <= OP_FX0A - OP_WAIT && (idle = skip_idle(C8, left)) > 0){
+            left -= idle;
+            continue;
+        }
+        run_insn(C8, in);                                   // The step of every run loop in chip8.c
+        left--;
+        if(C8->unknown != unknown){                         // Seen by its count, as the handler leaves PC on it
+            kind = CRASH_UNKNOWN;
+            break;
+        }
+    }
+    E->prev = prev;
+    *done = n - left;
+    return kind;
+}
+
+static int run_input(EXPLORER *E, const KEYEVENT *events, int count, unsigned long *at, unsigned long n) // Run n instructions from instruction *at of the game, applying the key changes on theirs. Returns the crash, with *at where it happened
+{
+    unsigned long end = *at + n, stop, done;
+    int next = 0, kind;
+
+    E->prev = (E->C8.pc - 2) & 0xFFF;
+    while(*at < end)
+    {
+        while(next < count && events[next].at <= *at)
+            set_keys(&E->C8, events[next++].keys);
+        stop = next < count && events[next].at < end ? events[next].at : end;
+        kind = run_span(E, stop - *at, &done);
+        *at += done;
+        E->instructions += done;
+        if(kind != CRASH_NONE)
+            return kind;
+    }
+    return CRASH_NONE;
+}
+
+static void add_event(EXPLORER *E, unsigned long at, unsigned short int keys)
+{
+    KEYEVENT *grown;
+
+    if(E->ninput == E->size)
+    {
+        E->size = E->size ? E->size * 2 : 256;
+        if((grown = realloc(E->input, E->size * sizeof(KEYEVENT))) == NULL)
+            exit(1);
+        E->input = grown;
+    }
+    E->input[E->ninput].at = at;
+    E->input[E->ninput].keys = keys;
+    E->ninput++;
+}
+
+static void generate(EXPLORER *E, unsigned long from, unsigned long n) // Keys for n instructions: nothing or a key, now and then two, each held up to HOLD frames
+{
+    unsigned long at = from, ipf = E->C8.ipf;
+    unsigned short int keys;
+    uint32_t r;
+
+    while(at < from + n)
+    {
+        r = rnd(E);
+        keys = 0;
+        if(r & 3)
+            keys = 1 << (r >> 2 & 0xF);
+        if((r & 0x1C0) == 0)
+            keys |= 1 << (r >> 9 & 0xF);
+        add_event(E, at, keys);
+        at += (1 + (r >> 13) % HOLD) * ipf - (r >> 24) % ipf; // Not always on a frame
+    }
+}
+
+static void write_recording(const char *path, const KEYEVENT *events, int count)
+{
+    FILE *f = fopen(path, "w");
+    int i;
+
+    if(f == NULL){
+        printf("Error. %s can't be written!\n", path);
+        return;
+    }
+    for(i = 0; i < count; i++)
+        fprintf(f, "%lu %04x\n", events[i].at, events[i].keys);
+    fclose(f);
+}
+
+static void keep(EXPLORER *E, int depth, unsigned long at)  // The machine and the run's input make a new entry
+{
+    ENTRY *e = &E->corpus[E->count];
+
+    if(E->count == CORPUS || (e->state = malloc(sizeof(STATE))) == NULL)
+        return;
+    if((e->events = malloc((E->ninput > 0 ? E->ninput : 1) * sizeof(KEYEVENT))) == NULL){
+        free(e->state);
+        return;
+    }
+    save_state(&E->C8, e->state);
+    memcpy(e->events, E->input, E->ninput * sizeof(KEYEVENT));
+    e->nevents = E->ninput;
+    e->at = at;
+    e->picks = 0;
+    e->depth = depth;
+    E->count++;
+}
+
+static void crash(EXPLORER *E, int kind, unsigned long at)  // Report a crash the first time it is found at an address
+{
+    unsigned short int pc = E->C8.pc & 0xFFF;
+    char path[512];
+    int n;
+
+    if(E->crashed[kind][pc])
+        return;
+    E->crashed[kind][pc] = 1;
+    E->crashes++;
+    printf("crash: %s at 0x%03X, opcode 0x%04X, instruction %lu\n", crash_names[kind], pc, E->C8.decoded[pc].opcode, at);
+    if(E->out == NULL)
+        return;
+    for(n = E->ninput; n > 0 && E->input[n - 1].at > at; n--)   // The keys up to the crash
+        ;
+    snprintf(path, sizeof(path), "%s/crash-%d.keys", E->out, E->crashes);
+    write_recording(path, E->input, n);
+}
+
+static ENTRY *pick(EXPLORER *E)                             // The entry of two at random that has had fewer runs
+{
+    ENTRY *a = &E->corpus[rnd(E) % E->count], *b = &E->corpus[rnd(E) % E->count];
+    return a->picks <= b->picks ? a : b;
+}
+
+static void status(EXPLORER *E, double elapsed, FILE *out)
+{
+    fprintf(out, "runs %lu (%.0f a second), corpus %d, addresses %lu, branches %lu, crashes %d\n",
+            E->runs, elapsed > 0 ? E->runs / elapsed : 0.0, E->count, E->addresses, E->branches, E->crashes);
+}
+
+static void explore(EXPLORER *E, double limit, unsigned long most)
+{
+    ENTRY *P;
+    unsigned long at;
+    double begin = seconds(), now, shown = begin;
+    int kind, i, n;
+
+    keep(E, 0, 0);                                          // The game as loaded
+    while(E->runs < most)
+    {
+        if((E->runs & 255) == 0)
+        {
+            if((now = seconds()) - begin >= limit)
+                break;
+            if(now - shown >= 1){
+                status(E, now - begin, stderr);
+                shown = now;
+            }
+        }
+        P = pick(E);
+        P->picks++;
+        restore_state(&E->C8, P->state);
+        if(E->size < P->nevents + 1)                        // Room for the entry's input, generate() grows it from there
+        {
+            E->size = P->nevents + 256;
+            if((E->input = realloc(E->input, E->size * sizeof(KEYEVENT))) == NULL)
+                exit(1);
+        }
+        memcpy(E->input, P->events, P->nevents * sizeof(KEYEVENT));
+        E->ninput = P->nevents;
+        generate(E, P->at, E->span);
+
+        E->found = 0;
+        at = P->at;
+        kind = run_input(E, E->input + P->nevents, E->ninput - P->nevents, &at, E->span);
+        E->runs++;
+        if(kind != CRASH_NONE)
+            crash(E, kind, at);
+        else if(E->found > 0)
+            keep(E, P->depth + 1, at);
+    }
+
+    now = seconds() - begin;
+    printf("runs: %lu\n", E->runs);
+    printf("seconds: %f\n", now);
+    if(now > 0){
+        printf("runs per second: %.0f\n", E->runs / now);
+        printf("instructions per second: %.0f\n", E->instructions / now);
+    }
+    printf("corpus: %d\n", E->count);
+    printf("addresses: %lu\n", E->addresses);
+    printf("branches: %lu\n", E->branches);
+    for(i = 0, n = 0; i < OPS; i++)
+        n += E->ops[i];
+    printf("handlers: %d of %d:", n, OPS - 1);             // OP_DECODE never runs once decoded
+    for(i = 0, n = 0; i < OPS; i++)
+        if(E->ops[i])
+            printf("%s %s", n++ > 0 ? "," : "", op_name(i));    // Commas, a few names have spaces
+    printf("\n");
+    printf("crashes: %d\n", E->crashes);
+}
+
+static void write_corpus(EXPLORER *E)
+{
+    char path[512];
+    FILE *manifest;
+    int i;
+
+    snprintf(path, sizeof(path), "%s/manifest", E->out);
+    if((manifest = fopen(path, "w")) == NULL){
+        printf("Error. %s can't be written!\n", path);
+        return;
+    }
+    for(i = 0; i < E->count; i++)
+    {
+        snprintf(path, sizeof(path), "%s/entry-%d.keys", E->out, i);
+        write_recording(path, E->corpus[i].events, E->corpus[i].nevents);
+        fprintf(manifest, "%s %s\n", E->game, path);
+    }
+    fclose(manifest);
+}
+
+static int replay(EXPLORER *E, char *recording)             // Run a recording from the start and report the first crash
+{
+    SESSION S;
+    unsigned long at = 0, budget;
+    int kind;
+
+    memset(&S, 0, sizeof(S));
+    if(load_recording(recording, &S) != 0)
+        return -1;
+    budget = (S.nevents > 0 ? S.events[S.nevents - 1].at : 0) + E->span;
+    kind = run_input(E, S.events, S.nevents, &at, budget);
+    if(kind != CRASH_NONE)
+        printf("crash: %s at 0x%03X, opcode 0x%04X, instruction %lu\n", crash_names[kind], E->C8.pc & 0xFFF, E->C8.decoded[E->C8.pc & 0xFFF].opcode, at);
+    else
+        printf("no crash in %lu instructions\n", at);
+    free(S.events);
+    return kind != CRASH_NONE;
+}
+
+int main(int argc, char *argv[])
+{
+    static EXPLORER E;
+    double limit = 10;
+    unsigned long frames = 60, most = (unsigned long)-1;
+    uint32_t seed = 1;
+    char *recording = NULL;
+    int i, result;
+
+    for(i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+            frames = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            limit = atof(argv[++i]);
+        else if(strcmp(argv[i], "-x") == 0 && i + 1 < argc)
+            most = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "-seed") == 0 && i + 1 < argc)
+            seed = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "-ipf") == 0 && i + 1 < argc)
+            ipf = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            E.out = argv[++i];
+        else if(strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+            recording = argv[++i];
+        else
+            E.game = argv[i];
+    }
+    if(E.game == NULL){
+        printf("Usage: %s [-f frames] [-t seconds] [-x runs] [-seed seed] [-ipf N] [-o dir] [-r recording] game\n", argv[0]);
+        return 1;
+    }
+    if(prepare_game(&E.C8, E.game) != 0)
+        return 1;
+    seed_random(&E.C8, seed);                               // The machine's numbers and the keys both follow the seed, so a recording runs again the same
+    E.random = seed != 0 ? seed : 1;
+    E.span = (frames > 0 ? frames : 1) * E.C8.ipf;
+
+    if(recording != NULL)
+        return (result = replay(&E, recording)) < 0 ? 1 : result;
+
+    if(E.out != NULL)
+        mkdir(E.out, 0777);
+    explore(&E, limit, most);
+    if(E.out != NULL)
+        write_corpus(&E);
+    return E.crashes > 0;
+}
@@ -0,0 +1,399 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "chip8.h"
+#include "pack.h"
+#include "frontend.h"
+#include "display.h"
+#include "state.h"
+#include "input.h"
+#include "profile.h"
+#include "trace.h"
+#include "audio.h"
+
+#define TITLE "CHIP-8 EMULATOR BY VIATA"
+#define SCREEN_WIDTH 640                                // Width of the window
+#define SCREEN_HEIGHT 320                               // Height of the window
+#define SCREEN_BPP 32                                   // Bits per pixel
+#define HISTORY_BYTES (8 << 20)                         // Memory given to the rewind buffer
+#define HISTORY_FRAMES (60 * 60 * 10)                   // At most ten minutes of it
+#define HISTORY_KEYFRAME 60                             // One keyframe a second
+#define SLEEP_MS 500                                    // Longest sleep of the machine while the game waits for a key
+#define POLL_MS 100                                     // Longest wait of the window for a key or a frame
+#define OVERLAY_FRAMES 30                               // Frames between updates of the profile overlay
+#define MAXSKIP 4                                       // Frames the machine may fall behind before it stops catching up
+#define FRESH 4                                         // Set in TRIPLE.middle while the frame there is newer than the window's
+
+SDL_Window *window = NULL;
+SDL_Renderer *renderer = NULL;
+SDL_Texture *texture = NULL;                            // The 128x64 screen, or the 64x32 corner of it, scaled up to the window by the renderer
+int software = 0;                                       // Use SDL's software renderer, for hosts without a GPU
+int turbo = 0;                                          // Run uncapped, still presenting 60 times a second
+int frameskip = 0;                                      // Frames run and not handed over between two that are
+int latency = 0;                                        // Print the input to photon latency on the way out
+
+static uint64_t shown[PLANES * HIRES_H * 2];            // The screen as it was last presented
+static uint32_t pixels[HIRES_H * HIRES_W];              // The same screen in ARGB, as uploaded to the texture
+static int uploaded = 0;                                // Set once the texture holds the whole screen
+static int shown_hires = 0;                             // Resolution it was presented in
+
+static TRIPLE triple;                                   // Frames from the machine to the window
+static INPUT input;                                     // Keys from the window to the machine
+static SDL_sem *wake = NULL;                            // Posted by the window to wake a machine sleeping on a key
+static Uint32 frame_event = (Uint32)-1;                 // Event the machine sends to wake the window on a new frame
+
+static int present(const uint64_t *graphics, int hires)
+{
+    SDL_Rect dirty, screen;
+    uint64_t rows = expand_graphics(pixels, shown, graphics, hires);   // Only the rows that changed are expanded
+    int width = hires ? HIRES_W : W, height = hires ? HIRES_H : H, first = 0, last = height - 1;
+
+    if(hires != shown_hires){                           // The other corner of the texture: all of it goes up
+        shown_hires = hires;
+        uploaded = 0;
+    }
+    if(rows == 0 && uploaded)
+        return 0;
+
+    if(uploaded)                                        // Send the band of rows from the first to the last that changed
+    {
+        while(!(rows & ((uint64_t)1 << first)))
+            first++;
+        while(!(rows & ((uint64_t)1 << last)))
+            last--;
+    }
+    dirty.x = 0;
+    dirty.y = first;
+    dirty.w = width;
+    dirty.h = last - first + 1;
+    SDL_UpdateTexture(texture, &dirty, &pixels[first * HIRES_W], HIRES_W * sizeof(uint32_t));
+    uploaded = 1;
+
+    screen.x = 0;
+    screen.y = 0;
+    screen.w = width;
+    screen.h = height;
+    SDL_RenderCopy(renderer, texture, &screen, NULL);   // One copy, the renderer does the scaling
+    SDL_RenderPresent(renderer);                        // Update the screen, at the display's refresh
+    return 1;
+}
+
+int render(const FRAME *F)
+{
+    return present(F->graphics[0][0], F->hires);
+}
+
+static void hand_frame(CH *C8, unsigned long seq, const char *status) // Give the window the screen as it is now
+{
+    static uint64_t carried = 0;                        // Key transitions of a frame the window never took
+    FRAME *F = &triple.frame[triple.back];
+    uint64_t unseen = take_unseen(&input);
+    unsigned int old;
+    SDL_Event event;
+
+    if(carried != 0 && (unseen == 0 || carried < unseen))
+        unseen = carried;
+    memcpy(F->graphics, C8->graphics, sizeof(F->graphics));
+    F->hires = C8->hires;
+    F->seq = seq;
+    F->unseen = unseen;
+    snprintf(F->status, sizeof(F->status), "%s", status);
+    C8->draw = 0;                                       // Set the flag to 0 to not keep drawing over and over
+
+    old = atomic_exchange_explicit(&triple.middle, triple.back | FRESH, memory_order_acq_rel); // The frame is complete before the window can see it
+    triple.back = old & 3;
+    carried = old & FRESH ? triple.frame[triple.back].unseen : 0;
+
+    memset(&event, 0, sizeof(event));
+    event.type = frame_event;
+    SDL_PushEvent(&event);
+}
+
+static const FRAME *take_frame()                        // The newest frame since the last call, NULL when there is none
+{
+    unsigned int old;
+    if(!(atomic_load_explicit(&triple.middle, memory_order_relaxed) & FRESH))
+        return NULL;
+    old = atomic_exchange_explicit(&triple.middle, triple.front, memory_order_acq_rel);
+    triple.front = old & 3;
+    return &triple.frame[triple.front];
+}
+
+static void profile_status(PROFILE *P, char *status, size_t size) // The live overlay: where the time of the last few frames went
+{
+    static double cpu = 0;
+    int op[3], n, i, len;
+
+    status[0] = 0;
+    if(P == NULL || P->instructions == 0)
+        return;
+    if(P->cpu < cpu)                                    // A new profile
+        cpu = 0;
+    len = snprintf(status, size, "cpu %.2f ms a frame |", (P->cpu - cpu) * 1000 / OVERLAY_FRAMES);
+    cpu = P->cpu;
+    n = top_ops(P, op, 3);
+    for(i = 0; i < n && len < (int)size; i++)
+        len += snprintf(status + len, size - len, " %s %.0f%%", op_name(op[i]), 100.0 * P->ops[op[i]] / P->instructions);
+    if(len < (int)size)
+        snprintf(status + len, size - len, " | calls %d deep, %d at most", P->depth, P->deepest);
+}
+
+static void wait_until(Uint64 deadline)                 // Sleep most of the way to a performance counter value, then spin the rest
+{
+    Uint64 now, freq = SDL_GetPerformanceFrequency();
+    while((now = SDL_GetPerformanceCounter()) < deadline)
+    {
+        if(deadline - now > freq / 500)                 // SDL_Delay is only good to a millisecond or two
+            SDL_Delay((Uint32)((deadline - now) * 1000 / freq) - 1);
+    }
+}
+
+static int machine(void *arg)                           // The thread that runs the game and hands its frames over
+{
+    CH *C8 = arg;
+    REWIND history;                                     // Hold backspace to go back in time
+    int rewinding, overlay, skipped = 0, changed;
+    int rewind = trace_path == NULL && open_rewind(&history, HISTORY_BYTES, HISTORY_FRAMES, HISTORY_KEYFRAME) == 0; // A trace is one run from start to end, going back would break it
+    char status[STATUS] = "";
+
+    Uint64 period = SDL_GetPerformanceFrequency() / 60; // One frame of the machine, in performance counter ticks
+    Uint64 next = SDL_GetPerformanceCounter();         // When the frame being run is due to end
+    Uint64 begin;
+    unsigned long frames = 0, seq = 0;
+
+    if(profile_path != NULL || stacks_path != NULL)
+        start_profile(C8);
+    if(trace_path != NULL)
+        start_trace(C8, trace_path);
+    if(!mute)                                           // Silent without a sound device
+        open_audio(C8);
+
+    while(!atomic_load(&input.quit))
+    {
+        rewinding = rewind && atomic_load(&input.rewind);
+        overlay = atomic_load(&input.overlay);
+        changed = 0;
+        if(overlay && C8->profile == NULL)             // F1: profile from now on, and show it
+            start_profile(C8);
+        else if(!overlay && frames != 0){
+            status[0] = 0;
+            frames = 0;
+            changed = 1;
+        }
+
+        if(!rewinding && !pending_input(&input) && sleeping(C8)) // Nothing will happen until a key: sleep instead of running empty frames
+        {
+            if(C8->draw == 1 || changed)
+                hand_frame(C8, ++seq, status);
+            SDL_SemWaitTimeout(wake, SLEEP_MS);
+            next = SDL_GetPerformanceCounter();
+            continue;
+        }
+
+        next += period;
+        if(rewinding)                                  // Play the history backwards, a frame every 60th of a second
+        {
+            hush_audio(C8);
+            if(pop_rewind(&history, C8) == 0)
+                hand_frame(C8, ++seq, status);
+            wait_until(next);
+            continue;
+        }
+
+        begin = SDL_GetPerformanceCounter();
+        if(turbo)                                      // As many frames as fit in this 60th of a second
+        {
+            apply_input(&input, C8);
+            do
+                run_frame(C8);
+            while(SDL_GetPerformanceCounter() < next);
+        }
+        else                                           // ipf instructions, with the keys that came since the last frame
+            run_input_frame(&input, C8);
+        if(C8->profile != NULL)
+            C8->profile->cpu += (double)(SDL_GetPerformanceCounter() - begin) / SDL_GetPerformanceFrequency();
+        if(overlay && ++frames % OVERLAY_FRAMES == 0){
+            profile_status(C8->profile, status, sizeof(status));
+            changed = 1;
+        }
+        if(rewind)
+            push_rewind(&history, C8);
+
+        if(SDL_GetPerformanceCounter() > next + MAXSKIP * period) // Too far behind to catch up, start counting from here
+            next = SDL_GetPerformanceCounter();
+
+        if(C8->draw == 1 || changed)                   // Hands frames over only when they changed, and not the ones skipped
+        {
+            if(skipped < frameskip)
+                skipped++;
+            else{
+                hand_frame(C8, ++seq, status);
+                skipped = 0;
+            }
+        }
+        if(!turbo)
+            wait_until(next);
+    }
+
+    if(rewind)
+        close_rewind(&history);
+    close_audio(C8);
+    stop_trace(C8);
+    return 0;
+}
+
+static int open_renderer()
+{
+    int i;
+    if(!software)
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    if(renderer == NULL)                                // No GPU, or asked not to use it
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
+    if(renderer == NULL)
+        return -1;
+
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, HIRES_W, HIRES_H);
+    if(texture == NULL)
+        return -1;
+
+    for(i = 0; i < PLANES * HIRES_H * 2; i++)           // Blank screen, matching the pixels below
+        shown[i] = 0;
+    for(i = 0; i < HIRES_H * HIRES_W; i++)
+        pixels[i] = PIXEL_OFF;
+    uploaded = 0;
+    return 0;
+}
+
+static void close_window()                              // Whatever of the window was opened, and SDL
+{
+    if(texture != NULL)
+        SDL_DestroyTexture(texture);
+    if(renderer != NULL)
+        SDL_DestroyRenderer(renderer);
+    if(window != NULL)
+        SDL_DestroyWindow(window);
+    texture = NULL;
+    renderer = NULL;
+    window = NULL;
+    SDL_Quit();
+}
+
+static void open_triple()
+{
+    memset(&triple, 0, sizeof(triple));
+    atomic_init(&triple.middle, 1);                     // The machine fills 0, the window shows 2
+    triple.back = 0;
+    triple.front = 2;
+}
+
+void start()
+{
+    char game[FILENAME_MAX];
+    printf("Write the name of the game: ");
+    if(fgets(game, sizeof(game), stdin) == NULL)
+        return;
+    game[strcspn(game, "\r\n")] = '\0';                // The whole line, spaces and all
+
+    initalize(game);
+}
+
+void initalize(char *game)
+{
+    CH C8;
+    if(prepare_game(&C8, game) != 0)                // Resets everything
+        return;
+
+    if(SDL_Init(SDL_INIT_EVERYTHING) == -1)
+        return;
+
+    window = SDL_CreateWindow(TITLE, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+
+    if(window == NULL || open_renderer() != 0){
+        close_window();
+        return;
+    }
+
+    const FRAME *F;
+    SDL_Thread *thread;
+    char status[STATUS] = "", title[STATUS + 64];
+    Uint64 begin;
+    double rendered = 0, drawn = 0;                     // Seconds spent presenting, in all and when the overlay last changed
+    unsigned long presented = 0, counted = 0;
+    int fresh;
+
+    open_input(&input);
+    open_triple();
+    frame_event = SDL_RegisterEvents(1);
+    if((wake = SDL_CreateSemaphore(0)) == NULL || (thread = SDL_CreateThread(machine, "machine", &C8)) == NULL)
+    {
+        if(wake != NULL)
+            SDL_DestroySemaphore(wake);
+        close_window();
+        return;
+    }
+
+    while(!atomic_load(&input.quit))
+    {
+        SDL_WaitEventTimeout(NULL, POLL_MS);           // Until a key, a frame or a while
+        poll_input(&input);                            // Every event since the last time round
+        if((atomic_load(&input.quit) || atomic_load(&input.rewind) || pending_input(&input)) && SDL_SemValue(wake) == 0)
+            SDL_SemPost(wake);
+
+        fresh = (F = take_frame()) != NULL;
+        if(!fresh && input.redraw)                     // Exposed or resized: the frame shown last, again
+            F = &triple.frame[triple.front];
+        if(F == NULL)
+            continue;
+        if(input.redraw){                              // What was on the window is gone, all of the texture goes up and is presented
+            input.redraw = 0;
+            uploaded = 0;
+        }
+        begin = SDL_GetPerformanceCounter();
+        if(render(F) && fresh){
+            presented_input(&input, F->unseen, SDL_GetPerformanceCounter());
+            presented++;
+        }
+        rendered += (double)(SDL_GetPerformanceCounter() - begin) / SDL_GetPerformanceFrequency();
+
+        if(strcmp(F->status, status) != 0)             // The overlay changed: show it with the window's own share of the time
+        {
+            snprintf(status, sizeof(status), "%s", F->status);
+            snprintf(title, sizeof(title), "%s | %s | render %.2f ms a frame", TITLE, status,
+                     presented > counted ? (rendered - drawn) * 1000 / (presented - counted) : 0.0);
+            SDL_SetWindowTitle(window, status[0] != 0 ? title : TITLE);
+            counted = presented;
+            drawn = rendered;
+        }
+    }
+
+    SDL_WaitThread(thread, NULL);
+    if(latency)
+        print_latency(&input, stdout);
+    if(C8.profile != NULL)
+        C8.profile->render = rendered;
+    stop_profile(&C8);
+    SDL_DestroySemaphore(wake);
+    close_window();
+}
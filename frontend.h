@@ -0,0 +1,85 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef FRONTEND_H_INCLUDED
+#define FRONTEND_H_INCLUDED
+
+#include <stdatomic.h>
+#include <SDL.h>
+#include "chip8.h"
+
+
+#define STATUS 256                      // Bytes of the overlay text a frame carries
+
+
+/*
+ * SDL front end. Everything that needs a window, a surface or the
+ * keyboard lives here so the core in chip8.c can run without SDL.
+ *
+ * Two threads. The machine runs on one of its own, a frame of ipf
+ * instructions at a time, 60 frames a second by the performance counter,
+ * sleeping for most of the wait and spinning for the last bit of it.
+ * Turbo runs frames back to back instead. While the game waits for a key
+ * with its timers stopped that thread sleeps until the keyboard wakes it.
+ *
+ * Finished frames go to the window thread through a triple buffer: one
+ * frame being filled, one being shown and one in between, swapped with a
+ * single atomic exchange, so neither side ever waits for the other and
+ * the window always gets the newest frame. Frames are numbered; the
+ * window presents when the number moves on, at the display's refresh,
+ * and polls the keyboard in between. Keys go the other way through the
+ * queue of input.c.
+ */
+
+
+typedef struct Frame                    // begin frame struct
+{
+
+    uint64_t graphics[PLANES][HIRES_H][2]; // The screen, laid out as CH.graphics
+    unsigned char hires;                // In 128x64
+    unsigned long seq;                  // Frame of the machine it shows, counting from 1
+    uint64_t unseen;                    // When the oldest key transition it is the first to show happened, 0 for none
+    char status[STATUS];                // Profile overlay for the title bar, empty for none
+
+}FRAME;                                 // end frame struct
+
+typedef struct Triple                   // begin triple buffer struct
+{
+
+    FRAME frame[3];
+    atomic_uint middle;                 // Index of the frame in between, with FRESH set until the window takes it
+    int back;                           // Frame being filled, owned by the machine's thread
+    int front;                          // Frame being shown, owned by the window's thread
+
+}TRIPLE;                                // end triple buffer struct
+
+
+extern int software;                  // Set to render without the GPU
+extern int turbo;                     // Set to run as fast as the host can
+extern int frameskip;                 // Frames not handed to the window between two that are
+extern int latency;                   // Set to print the input to photon latency on the way out
+
+int render(const FRAME *);            // To render a frame, only the rows that changed since the last call are sent. Returns 1 if it presented
+void start();                         // To input the game
+void initalize(char *);               // To initialize the game
+
+
+#endif // FRONTEND_H_INCLUDED
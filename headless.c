@@ -0,0 +1,101 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+
+#include <stdio.h>
+#include <time.h>
+#include "chip8.h"
+#include "pack.h"
+#include "headless.h"
+#include "block.h"
+#include "profile.h"
+#include "trace.h"
+#include "audio.h"
+#include "quirks.h"
+
+static double seconds()                                 // Monotonic wall clock, in seconds
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void dump_graphics(CH *C8, FILE *out)
+{
+    int y, x, width = C8->hires ? HIRES_W : W, height = C8->hires ? HIRES_H : H;
+    for(y = 0; y < height; y++)
+    {
+        for(x = 0; x < width; x++)
+            fputc(".#+@"[PLANE_PIXEL(C8, 0, x, y) | PLANE_PIXEL(C8, 1, x, y) << 1], out);
+        fputc('\n', out);
+    }
+}
+
+int run_headless(char *game, unsigned long instructions, unsigned long frames, int blocks)
+{
+    CH C8;
+    unsigned long budget, done, chunk;
+    double begin, elapsed;
+
+    if(prepare_game(&C8, game) != 0)
+        return -1;
+
+    budget = instructions;                              // A frame budget is turned into instructions
+    if(frames > 0)
+        budget = frames * C8.ipf;
+
+    if(profile_path != NULL || stacks_path != NULL)
+        start_profile(&C8);
+    if(trace_path != NULL && start_trace(&C8, trace_path) == NULL)
+        return -1;
+
+    if(wav_path != NULL && open_wav(&C8, wav_path) != 0)
+        return -1;
+
+    begin = seconds();
+    for(done = 0; done < budget; done += chunk)         // A frame at a time when the sound is written behind it, so its ring never fills
+    {
+        chunk = C8.audio != NULL && budget - done > C8.ipf ? C8.ipf : budget - done;
+        if(blocks)
+            run_blocks(&C8, chunk);
+        else
+            run_cycles(&C8, chunk);
+        write_wav(&C8);
+    }
+    elapsed = seconds() - begin;
+    close_audio(&C8);
+    stop_trace(&C8);
+    free_blocks(&C8);
+    if(C8.profile != NULL){
+        C8.profile->cpu = elapsed;
+        stop_profile(&C8);
+    }
+
+    dump_graphics(&C8, stdout);
+    printf("quirks: %s\n", quirks_name(C8.quirks));
+    if(C8.unknown > 0)
+        printf("unknown opcodes: %lu\n", C8.unknown);
+    printf("instructions: %lu\n", budget);
+    printf("seconds: %f\n", elapsed);
+    if(elapsed > 0)
+        printf("instructions per second: %.0f\n", budget / elapsed);
+    return 0;
+}
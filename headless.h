@@ -0,0 +1,42 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef HEADLESS_H_INCLUDED
+#define HEADLESS_H_INCLUDED
+
+#include "chip8.h"
+
+
+/*
+ * Headless driver. Runs a game with no window, no delay and no SDL at
+ * all, then dumps the framebuffer and the instructions per second.
+ * The budget is given in instructions or in 60 Hz frames of the machine,
+ * ipf instructions each.
+ * With -blocks the game runs through the basic block cache of block.c.
+ * With -wav the buzzer is written to a file as the machine goes.
+ */
+
+
+int run_headless(char *, unsigned long, unsigned long, int); // Game, instruction budget, frame budget, run through the block cache. Returns -1 if the game can't be loaded
+void dump_graphics(CH *, FILE *);                        // Print the framebuffer as text at its resolution, '#' for a pixel on and '.' for off, '+' and '@' for the second plane and both
+
+
+#endif // HEADLESS_H_INCLUDED
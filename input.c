@@ -0,0 +1,200 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+
+
+#include <string.h>
+#include "input.h"
+
+static const struct { int scancode; unsigned char key; } layout[KEYNUM] =  // The keypad on the left of a QWERTY keyboard
+{
+    { SDL_SCANCODE_1, 0x1 }, { SDL_SCANCODE_2, 0x2 }, { SDL_SCANCODE_3, 0x3 }, { SDL_SCANCODE_4, 0xC },
+    { SDL_SCANCODE_Q, 0x4 }, { SDL_SCANCODE_W, 0x5 }, { SDL_SCANCODE_E, 0x6 }, { SDL_SCANCODE_R, 0xD },
+    { SDL_SCANCODE_A, 0x7 }, { SDL_SCANCODE_S, 0x8 }, { SDL_SCANCODE_D, 0x9 }, { SDL_SCANCODE_F, 0xE },
+    { SDL_SCANCODE_Z, 0xA }, { SDL_SCANCODE_X, 0x0 }, { SDL_SCANCODE_C, 0xB }, { SDL_SCANCODE_V, 0xF }
+};
+
+void open_input(INPUT *I)
+{
+    int i;
+    memset(I->keymap, -1, sizeof(I->keymap));
+    for(i = 0; i < KEYNUM; i++)
+        I->keymap[layout[i].scancode] = layout[i].key;
+    atomic_init(&I->head, 0);
+    atomic_init(&I->tail, 0);
+    atomic_init(&I->quit, 0);
+    atomic_init(&I->rewind, 0);
+    atomic_init(&I->overlay, 0);
+    I->redraw = 0;
+    I->freq = SDL_GetPerformanceFrequency();
+    I->unseen = 0;
+    I->total = 0;
+    I->worst = 0;
+    I->measured = 0;
+    I->dropped = 0;
+}
+
+static void push(INPUT *I, Uint64 at, unsigned char key, unsigned char down)
+{
+    unsigned int tail = atomic_load_explicit(&I->tail, memory_order_relaxed);
+    TRANSITION *t;
+
+    if(tail - atomic_load_explicit(&I->head, memory_order_acquire) == INPUTQ){
+        I->dropped++;
+        return;
+    }
+    t = &I->queue[tail % INPUTQ];
+    t->at = at;
+    t->key = key;
+    t->down = down;
+    atomic_store_explicit(&I->tail, tail + 1, memory_order_release);  // The slot is written before the reader can see it
+}
+
+static TRANSITION *peek(INPUT *I)                           // Oldest transition queued, NULL when none
+{
+    unsigned int head = atomic_load_explicit(&I->head, memory_order_relaxed);
+    if(head == atomic_load_explicit(&I->tail, memory_order_acquire))
+        return NULL;
+    return &I->queue[head % INPUTQ];
+}
+
+static void pop(INPUT *I)
+{
+    atomic_store_explicit(&I->head, atomic_load_explicit(&I->head, memory_order_relaxed) + 1, memory_order_release);
+}
+
+void poll_input(INPUT *I)
+{
+    SDL_Event event;
+    Uint64 now = SDL_GetPerformanceCounter();
+    Uint32 ticks = SDL_GetTicks(), ago;
+    int key;
+
+    while(SDL_PollEvent(&event))
+    {
+        if(event.type == SDL_QUIT){
+            atomic_store(&I->quit, 1);
+            continue;
+        }
+        if(event.type == SDL_WINDOWEVENT && (event.window.event == SDL_WINDOWEVENT_EXPOSED || event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)){
+            I->redraw = 1;
+            continue;
+        }
+        if(event.type != SDL_KEYDOWN && event.type != SDL_KEYUP)
+            continue;
+
+        switch(event.key.keysym.scancode)
+        {
+            case SDL_SCANCODE_ESCAPE: atomic_store(&I->quit, 1); continue;
+            case SDL_SCANCODE_BACKSPACE: atomic_store(&I->rewind, event.type == SDL_KEYDOWN); continue;
+            case SDL_SCANCODE_F1: atomic_fetch_xor(&I->overlay, event.type == SDL_KEYDOWN && !event.key.repeat); continue;
+        }
+        if(event.key.repeat || event.key.keysym.scancode < 0 || event.key.keysym.scancode >= SDL_NUM_SCANCODES)
+            continue;
+        if((key = I->keymap[event.key.keysym.scancode]) < 0)
+            continue;
+
+        ago = ticks > event.key.timestamp ? ticks - event.key.timestamp : 0;   // SDL stamps events in milliseconds
+        push(I, now - (Uint64)ago * I->freq / 1000, key, event.type == SDL_KEYDOWN);
+    }
+}
+
+int pending_input(INPUT *I)
+{
+    return peek(I) != NULL;
+}
+
+static void apply(INPUT *I, CH *C8, TRANSITION *t)
+{
+    C8->key[t->key] = t->down;
+    if(I->unseen == 0 || t->at < I->unseen)
+        I->unseen = t->at;
+}
+
+void apply_input(INPUT *I, CH *C8)
+{
+    TRANSITION *t;
+    while((t = peek(I)) != NULL)
+    {
+        apply(I, C8, t);
+        pop(I);
+    }
+}
+
+void run_input_frame(INPUT *I, CH *C8)
+{
+    TRANSITION *t;
+    unsigned long n = C8->tick < C8->ipf ? C8->ipf - C8->tick : 1;
+    unsigned int pressed = 0, release = 0;                  // Keys pressed since the last frame, and those to let go at its end
+
+    while((t = peek(I)) != NULL)
+    {
+        if(t->down){
+            apply(I, C8, t);
+            pressed |= 1u << t->key;
+            release &= ~(1u << t->key);
+        }
+        else if(pressed & (1u << t->key))                   // Released as soon as pressed: hold it to the end of the frame so the game can see it
+            release |= 1u << t->key;
+        else
+            apply(I, C8, t);
+        pop(I);
+    }
+    run_cycles(C8, n);
+
+    while(release != 0)
+    {
+        C8->key[__builtin_ctz(release)] = 0;
+        release &= release - 1;
+    }
+}
+
+Uint64 take_unseen(INPUT *I)
+{
+    Uint64 at = I->unseen;
+    I->unseen = 0;
+    return at;
+}
+
+void presented_input(INPUT *I, Uint64 unseen, Uint64 now)
+{
+    Uint64 latency;
+    if(unseen == 0 || now < unseen)
+        return;
+    latency = now - unseen;
+    I->total += latency;
+    if(latency > I->worst)
+        I->worst = latency;
+    I->measured++;
+}
+
+void print_latency(INPUT *I, FILE *out)
+{
+    if(I->measured == 0){
+        fprintf(out, "input to photon: no key measured\n");
+        return;
+    }
+    fprintf(out, "input to photon: %lu keys, %.1f ms average, %.1f ms worst", I->measured,
+            I->total * 1000.0 / I->freq / I->measured, I->worst * 1000.0 / I->freq);
+    if(I->dropped > 0)
+        fprintf(out, ", %lu dropped", I->dropped);
+    fprintf(out, "\n");
+}
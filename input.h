@@ -0,0 +1,93 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+
+#ifndef INPUT_H_INCLUDED
+#define INPUT_H_INCLUDED
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <SDL.h>
+#include "chip8.h"
+
+#define INPUTQ 256                      // Key transitions the queue holds, a power of two
+
+
+/*
+ * Input. poll_input() drains every event SDL has, maps the keys through a
+ * scancode table and queues the transitions of the keypad with the time
+ * they happened. The CPU side takes them off the queue at instruction
+ * boundaries: run_input_frame() applies every transition queued before
+ * the first instruction of the frame it runs, so a key is seen by the
+ * next frame after it happened, and a press and release that arrive
+ * together still leave the key down for the whole of that frame. The
+ * queue has one writer and one reader and no lock: poll_input() runs on
+ * the thread that owns the window, the rest on the one that runs the
+ * machine. The flags are atomic for the same reason.
+ *
+ * From a transition to the present of the first frame it shows is the
+ * input to photon latency, kept as a running total and worst case. The
+ * CPU side hands the time of the oldest one to the frame with
+ * take_unseen(), the window side gives it back to presented_input().
+ */
+
+
+typedef struct Transition               // begin key transition struct
+{
+
+    Uint64 at;                          // When it happened, by the performance counter
+    unsigned char key;                  // Key of the keypad, 0 to F
+    unsigned char down;                 // 1 pressed, 0 released
+
+}TRANSITION;                            // end key transition struct
+
+typedef struct Input                    // begin input struct
+{
+
+    TRANSITION queue[INPUTQ];
+    atomic_uint head;                   // Next to take off, moved by the CPU side only
+    atomic_uint tail;                   // Next to fill, moved by poll_input() only
+    signed char keymap[SDL_NUM_SCANCODES]; // Key of the keypad for a scancode, -1 for none
+    atomic_int quit;                    // Set on Escape or when the window is closed
+    atomic_int rewind;                  // Set while Backspace is held
+    atomic_int overlay;                 // Flipped by F1
+    int redraw;                         // Set when the window was exposed or resized, cleared by the window. Both on its thread
+    Uint64 freq;                        // Performance counter ticks per second
+    Uint64 unseen;                      // When the oldest transition applied and not handed to a frame yet happened, 0 for none
+    Uint64 total;                       // Latency of every measured transition added up, in ticks
+    Uint64 worst;
+    unsigned long measured;
+    unsigned long dropped;              // Transitions lost to a full queue
+
+}INPUT;                                 // end input struct
+
+
+void open_input(INPUT *);                           // Empty queue and the default keypad: 1234 QWER ASDF ZXCV
+void poll_input(INPUT *);                           // Drain SDL's events into the queue and the quit and rewind flags
+int pending_input(INPUT *);                         // 1 when transitions are waiting
+void apply_input(INPUT *, CH *);                    // Apply every transition queued, now
+void run_input_frame(INPUT *, CH *);                // Run a frame with every transition queued applied at its start
+Uint64 take_unseen(INPUT *);                        // When the oldest transition applied since the last call happened, 0 for none
+void presented_input(INPUT *, Uint64, Uint64);      // A frame showing transitions from the first time on was presented at the second
+void print_latency(INPUT *, FILE *);
+
+
+#endif // INPUT_H_INCLUDED
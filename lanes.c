@@ -0,0 +1,428 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+
+#include <string.h>
+#include "chip8.h"
+#include "lanes.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+typedef __m256i VB;                                         // A byte of every lane
+
+#define vload(p)        _mm256_loadu_si256((const __m256i *)(p))
+#define vstore(p, v)    _mm256_storeu_si256((__m256i *)(p), v)
+#define vset(b)         _mm256_set1_epi8((char)(b))
+#define vadd(a, b)      _mm256_add_epi8(a, b)
+#define vsub(a, b)      _mm256_sub_epi8(a, b)
+#define vand(a, b)      _mm256_and_si256(a, b)
+#define vor(a, b)       _mm256_or_si256(a, b)
+#define vxor(a, b)      _mm256_xor_si256(a, b)
+#define vadds(a, b)     _mm256_adds_epu8(a, b)
+#define vsubs(a, b)     _mm256_subs_epu8(a, b)
+#define vmax(a, b)      _mm256_max_epu8(a, b)
+#define veq(a, b)       _mm256_cmpeq_epi8(a, b)
+#define vshr1(a)        _mm256_and_si256(_mm256_srli_epi16(a, 1), vset(0x7F))
+#define vshr7(a)        _mm256_and_si256(_mm256_srli_epi16(a, 7), vset(0x01))
+
+#else
+
+typedef struct { unsigned char b[LANES]; } VB;              // Without AVX2 the same operations are loops the compiler vectorizes as it can
+
+static inline VB vload(const unsigned char *p) { VB v; memcpy(v.b, p, LANES); return v; }
+#define vstore(p, v)    memcpy(p, (v).b, LANES)
+#define LANEWISE(name, expr) static inline VB name(VB a, VB b) { VB r; int l; for(l = 0; l < LANES; l++) { unsigned char x = a.b[l], y = b.b[l]; r.b[l] = (expr); } return r; }
+static inline VB vset(unsigned char c) { VB v; memset(v.b, c, LANES); return v; }
+LANEWISE(vadd, x + y)
+LANEWISE(vsub, x - y)
+LANEWISE(vand, x & y)
+LANEWISE(vor, x | y)
+LANEWISE(vxor, x ^ y)
+LANEWISE(vadds, x + y > 0xFF ? 0xFF : x + y)
+LANEWISE(vsubs, x > y ? x - y : 0)
+LANEWISE(vmax, x > y ? x : y)
+LANEWISE(veq, x == y ? 0xFF : 0)
+static inline VB vshr1(VB a) { int l; for(l = 0; l < LANES; l++) a.b[l] >>= 1; return a; }
+static inline VB vshr7(VB a) { int l; for(l = 0; l < LANES; l++) a.b[l] >>= 7; return a; }
+
+#endif
+
+static int uses_keys(unsigned char op)
+{
+    return op == OP_EX9E || op == OP_EXA1 || op == OP_FX0A;
+}
+
+static void keys_to_lane(LOCKSTEP *G, int l)
+{
+    int r;
+    for(r = 0; r < KEYNUM; r++)
+        G->lane[l]->key[r] = G->key[r][l];
+}
+
+static void keys_from_lane(LOCKSTEP *G, int l)
+{
+    int r;
+    for(r = 0; r < KEYNUM; r++)
+        G->key[r][l] = G->lane[l]->key[r];
+}
+
+static void to_lane(LOCKSTEP *G, int l)                     // Lane-wise registers into the lane's CH, the keys only go when an instruction reads them
+{
+    CH *C8 = G->lane[l];
+    int r;
+    for(r = 0; r < REGISTER; r++)
+        C8->V[r] = G->V[r][l];
+    C8->I = G->I[l];
+    C8->pc = G->pc[l];
+    C8->delay_timer = G->delay_timer[l];
+    C8->sound_timer = G->sound_timer[l];
+    C8->tick = G->tick[l];
+}
+
+static void from_lane(LOCKSTEP *G, int l)                   // And back
+{
+    CH *C8 = G->lane[l];
+    int r;
+    for(r = 0; r < REGISTER; r++)
+        G->V[r][l] = C8->V[r];
+    G->I[l] = C8->I;
+    G->pc[l] = C8->pc;
+    G->delay_timer[l] = C8->delay_timer;
+    G->sound_timer[l] = C8->sound_timer;
+    G->tick[l] = C8->tick;
+    G->ipf[l] = C8->ipf;
+}
+
+static void mark_split(LOCKSTEP *G, int addr, int len)      // A lane wrote memory: flag the bytes where the lanes now disagree
+{
+    int i, l, a;
+    for(i = 0; i < len && addr + i < MEMOSZ; i++)
+    {
+        a = addr + i;
+        for(l = 1; l < LANES && !G->split[a]; l++)
+            if(G->lane[l]->memory[a] != G->lane[0]->memory[a])
+                G->split[a] = 1;
+    }
+}
+
+static void catch_up(LOCKSTEP *G)                           // Count the pending steps into every lane and tick the timers that are due
+{
+    int l;
+    G->due = 0;
+    for(l = 0; l < LANES; l++)
+    {
+        G->tick[l] += G->pending;
+        while(G->tick[l] >= G->ipf[l]){
+            G->tick[l] -= G->ipf[l];
+            if(G->delay_timer[l] > 0)
+                --G->delay_timer[l];
+            if(G->sound_timer[l] > 0)
+                --G->sound_timer[l];
+        }
+        if(G->due == 0 || G->ipf[l] - G->tick[l] < G->due)
+            G->due = G->ipf[l] - G->tick[l];
+    }
+    G->pending = 0;
+}
+
+static void elapse(LOCKSTEP *G)                             // One instruction went by in every lane. The timers are only looked at when one of them is due
+{
+    int l;
+    for(l = 0; l < LANES; l++)
+        G->executed[l]++;
+    if(++G->pending >= G->due)
+        catch_up(G);
+}
+
+static void scalar_step(LOCKSTEP *G, int l, int *lo, int *hi) // One instruction of one lane, through cycles(). Widens lo..hi to the memory it wrote
+{
+    CH *C8 = G->lane[l];
+    const INSN *in;
+    int addr = 0, len = 0;
+
+    if(G->pending > 0)                                      // The lane's own tick has to be up to date for cycles()
+        catch_up(G);
+    to_lane(G, l);
+    in = &C8->decoded[C8->pc & 0xFFF];
+    if(in->op == OP_DECODE)
+        decode_insn(C8, C8->pc & 0xFFF);
+    if(in->op == OP_FX33){
+        addr = C8->I & 0xFFF;
+        len = 3;
+    }
+    else if(in->op == OP_FX55 || in->op == OP_FX55_I){
+        addr = C8->I & 0xFFF;
+        len = in->x + 1;
+    }
+    else if(in->op == OP_5XY2){
+        addr = C8->I & 0xFFF;
+        len = (in->x > in->y ? in->x - in->y : in->y - in->x) + 1;
+    }
+    if(addr + len > MEMOSZ){                                // Wraps past the end of memory, rare enough to look at all of it
+        addr = 0;
+        len = MEMOSZ;
+    }
+    if(uses_keys(in->op))
+        keys_to_lane(G, l);
+    cycles(C8);
+    from_lane(G, l);
+    if(uses_keys(in->op))
+        keys_from_lane(G, l);
+    if(len > 0 && addr < *lo)
+        *lo = addr;
+    if(len > 0 && addr + len > *hi)
+        *hi = addr + len;
+    G->executed[l]++;
+    G->due = 1;                                             // Its tick moved: work out the next due step again on the next vector step
+}
+
+static void skip_if(LOCKSTEP *G, VB taken)                  // PC += 4 in the lanes where taken is 0xFF, 2 elsewhere
+{
+    unsigned char t[LANES];
+    int l;
+    vstore(t, taken);
+    for(l = 0; l < LANES; l++)
+        G->pc[l] += 2 + (t[l] & 2);
+}
+
+static void step_pc(LOCKSTEP *G)
+{
+    int l;
+    for(l = 0; l < LANES; l++)
+        G->pc[l] += 2;
+}
+
+static int vector_step(LOCKSTEP *G, const INSN *in)         // The instruction for every lane at once. Returns 0 if it has no vector form
+{
+    VB one = vset(1), vx, vy;
+    unsigned char *X = G->V[in->x], *Y = G->V[in->y], *F = G->V[0xF];
+    int l;
+
+    switch(in->op)
+    {
+        case OP_1NNN:
+            for(l = 0; l < LANES; l++)
+                G->pc[l] = in->opcode & 0x0FFF;
+            break;
+        case OP_3XNN: skip_if(G, veq(vload(X), vset(in->nn))); break;
+        case OP_4XNN: skip_if(G, vxor(veq(vload(X), vset(in->nn)), vset(0xFF))); break;
+        case OP_5XY0: skip_if(G, veq(vload(X), vload(Y))); break;
+        case OP_9XY0: skip_if(G, vxor(veq(vload(X), vload(Y)), vset(0xFF))); break;
+        case OP_6XNN: vstore(X, vset(in->nn)); step_pc(G); break;
+        case OP_7XNN: vstore(X, vadd(vload(X), vset(in->nn))); step_pc(G); break;
+        case OP_8XY0: vstore(X, vload(Y)); step_pc(G); break;
+        case OP_8XY1: vstore(X, vor(vload(X), vload(Y))); step_pc(G); break;
+        case OP_8XY2: vstore(X, vand(vload(X), vload(Y))); step_pc(G); break;
+        case OP_8XY3: vstore(X, vxor(vload(X), vload(Y))); step_pc(G); break;
+        case OP_8XY1_VF: vstore(X, vor(vload(X), vload(Y))); vstore(F, vset(0)); step_pc(G); break;
+        case OP_8XY2_VF: vstore(X, vand(vload(X), vload(Y))); vstore(F, vset(0)); step_pc(G); break;
+        case OP_8XY3_VF: vstore(X, vxor(vload(X), vload(Y))); vstore(F, vset(0)); step_pc(G); break;
+        case OP_8XY4:                                       // VF first, then VX, in the same order as the handlers in case X or Y is F
+            vx = vload(X);
+            vy = vload(Y);
+            vstore(F, vand(vxor(veq(vadds(vx, vy), vadd(vx, vy)), vset(0xFF)), one));
+            vstore(X, vadd(vload(X), vload(Y)));
+            step_pc(G);
+            break;
+        case OP_8XY5:
+            vx = vload(X);
+            vy = vload(Y);
+            vstore(F, vand(veq(vmax(vx, vy), vx), one));    // No borrow when VX >= VY
+            vstore(X, vsub(vload(X), vload(Y)));
+            step_pc(G);
+            break;
+        case OP_8XY6:
+            vstore(F, vand(vload(X), one));
+            vstore(X, vshr1(vload(X)));
+            step_pc(G);
+            break;
+        case OP_8XY7:
+            vx = vload(X);
+            vy = vload(Y);
+            vstore(F, vand(veq(vmax(vx, vy), vy), one));    // No borrow when VY >= VX
+            vstore(X, vsub(vload(Y), vload(X)));
+            step_pc(G);
+            break;
+        case OP_8XYE:
+            vstore(F, vshr7(vload(X)));
+            vx = vload(X);
+            vstore(X, vadd(vx, vx));
+            step_pc(G);
+            break;
+        case OP_8XY6_VY:
+            vstore(F, vand(vload(Y), one));
+            vstore(X, vshr1(vload(Y)));
+            step_pc(G);
+            break;
+        case OP_8XYE_VY:
+            vstore(F, vshr7(vload(Y)));
+            vy = vload(Y);
+            vstore(X, vadd(vy, vy));
+            step_pc(G);
+            break;
+        case OP_ANNN:
+            for(l = 0; l < LANES; l++)
+                G->I[l] = in->opcode & 0x0FFF;
+            step_pc(G);
+            break;
+        case OP_FX07: case OP_WAIT: catch_up(G); vstore(X, vload(G->delay_timer)); step_pc(G); break;
+        case OP_FX15: catch_up(G); vstore(G->delay_timer, vload(X)); step_pc(G); break;
+        case OP_FX18: catch_up(G); vstore(G->sound_timer, vload(X)); step_pc(G); break;
+        case OP_FX29:
+            for(l = 0; l < LANES; l++)
+                G->I[l] = X[l] * 5;
+            step_pc(G);
+            break;
+        default:
+            return 0;
+    }
+
+    elapse(G);
+    G->vector++;
+    return 1;
+}
+
+static int lane_step(LOCKSTEP *G, const INSN *in)           // Instructions that need each lane's own machine but only a few of its registers. Returns 0 for the rest
+{
+    CH *C8;
+    int l;
+
+    switch(in->op)
+    {
+        case OP_2NNN:                                       // The stack stays in the lane's CH
+            for(l = 0; l < LANES; l++)
+            {
+                C8 = G->lane[l];
+                C8->stack[C8->ps % STACKS] = G->pc[l];
+                C8->ps++;
+                G->pc[l] = in->opcode & 0x0FFF;
+            }
+            break;
+        case OP_00EE:
+            for(l = 0; l < LANES; l++)
+            {
+                C8 = G->lane[l];
+                C8->ps--;
+                G->pc[l] = C8->stack[C8->ps % STACKS] + 2;
+            }
+            break;
+        case OP_CXNN:
+            for(l = 0; l < LANES; l++)
+            {
+                G->V[in->x][l] = (next_random(G->lane[l]) % 0xFF) & in->nn;
+                G->pc[l] += 2;
+            }
+            break;
+        case OP_DXYN:
+            for(l = 0; l < LANES; l++)
+            {
+                G->V[0xF][l] = draw_sprite(G->lane[l], G->V[in->x][l], G->V[in->y][l], in->opcode & 0x000F, G->I[l]);
+                G->pc[l] += 2;
+            }
+            break;
+        default:
+            return 0;
+    }
+
+    elapse(G);
+    return 1;
+}
+
+void load_lockstep(LOCKSTEP *G, CH **lanes)
+{
+    int l, a;
+    memset(G, 0, sizeof(LOCKSTEP));
+    for(l = 0; l < LANES; l++)
+    {
+        G->lane[l] = lanes[l];
+        from_lane(G, l);
+        keys_from_lane(G, l);
+    }
+    for(a = 0; a < MEMOSZ; a++)                             // Lanes can start from different memory too
+        mark_split(G, a, 1);
+    catch_up(G);
+}
+
+void store_lockstep(LOCKSTEP *G)
+{
+    int l;
+    catch_up(G);
+    for(l = 0; l < LANES; l++)
+    {
+        to_lane(G, l);
+        keys_to_lane(G, l);
+    }
+}
+
+void run_lockstep(LOCKSTEP *G, unsigned long n)
+{
+    unsigned long target[LANES];
+    unsigned short int pc;
+    const INSN *in;
+    int l, low, together, lo, hi;
+
+    for(l = 0; l < LANES; l++)
+        target[l] = G->executed[l] + n;
+
+    for(;;)
+    {
+        pc = G->pc[0];
+        together = 1;
+        for(l = 0; l < LANES; l++)
+            if(G->pc[l] != pc || G->executed[l] >= target[l])
+                together = 0;
+
+        if(together && !G->split[pc & 0xFFF] && !G->split[(pc + 1) & 0xFFF])
+        {
+            in = &G->lane[0]->decoded[pc & 0xFFF];
+            if(in->op == OP_DECODE){
+                decode_insn(G->lane[0], pc & 0xFFF);
+                in = &G->lane[0]->decoded[pc & 0xFFF];
+            }
+            if(vector_step(G, in) || lane_step(G, in))
+                continue;
+        }
+
+        lo = MEMOSZ;
+        hi = 0;
+        if(together)                                        // Same instruction, no vector form: one lane at a time
+        {
+            for(l = 0; l < LANES; l++)
+                scalar_step(G, l, &lo, &hi);
+            if(lo < hi)                                     // Check what they wrote once, after all of them
+                mark_split(G, lo, hi - lo);
+            continue;
+        }
+
+        low = -1;                                           // Split up: step the lanes furthest behind in the code
+        for(l = 0; l < LANES; l++)
+            if(G->executed[l] < target[l] && (low < 0 || G->pc[l] < low))
+                low = G->pc[l];
+        if(low < 0)                                         // Every lane is done
+            break;
+        for(l = 0; l < LANES; l++)
+            if(G->executed[l] < target[l] && G->pc[l] == low)
+                scalar_step(G, l, &lo, &hi);
+        if(lo < hi)
+            mark_split(G, lo, hi - lo);
+    }
+}
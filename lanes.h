@@ -0,0 +1,68 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef LANES_H_INCLUDED
+#define LANES_H_INCLUDED
+
+#include "chip8.h"
+
+#define LANES 32                        // Instances stepped together, one per byte of an AVX2 register
+
+
+/*
+ * Lockstep interpreter. Runs LANES instances of the same game side by side,
+ * typically with different keys or random seeds. The registers, I, PC,
+ * timers and keys are stored lane-wise, so while every lane is at the same
+ * PC an ALU, load, skip or jump instruction is one vector operation for all
+ * of them. Everything else, and every step where the PCs differ, goes
+ * through cycles() on the lane's own CH, which also keeps its memory,
+ * screen, stack and random numbers. Lanes that split off are stepped
+ * lowest PC first, which brings them back together after most branches.
+ */
+
+
+typedef struct Lockstep                 // begin lockstep struct
+{
+
+    unsigned char V[REGISTER][LANES];   // V[r][lane]
+    unsigned short int I[LANES];
+    unsigned short int pc[LANES];
+    unsigned char delay_timer[LANES];
+    unsigned char sound_timer[LANES];
+    unsigned int tick[LANES];           // Instructions since each lane's timers ticked
+    unsigned int ipf[LANES];            // And how many there are to a tick
+    unsigned int pending;               // Steps of every lane not counted in tick yet
+    unsigned int due;                   // Pending steps at which some lane's timers have to tick
+    unsigned char key[KEYNUM][LANES];
+    unsigned long executed[LANES];      // Instructions run by each lane
+    unsigned long vector;               // Steps run as one vector operation for every lane
+    unsigned char split[MEMOSZ];        // Set where the memory of the lanes differs, lockstep never fetches there
+    CH *lane[LANES];                    // The rest of each lane's machine
+
+}LOCKSTEP;                              // end lockstep struct
+
+
+void load_lockstep(LOCKSTEP *, CH **);                // Take over LANES prepared instances
+void store_lockstep(LOCKSTEP *);                      // Write the lane-wise state back into the instances
+void run_lockstep(LOCKSTEP *, unsigned long);         // Run every lane that many instructions, same result as run_cycles() on each
+
+
+#endif // LANES_H_INCLUDED
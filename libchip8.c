@@ -0,0 +1,163 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+#include "quirks.h"
+#include "libchip8.h"
+
+struct Machine                          // begin machine struct
+{
+
+    CH C8;
+    unsigned int ipf;                   // Instructions per frame of every game loaded
+    int quirks;                         // Their quirks, QUIRKS_AUTO for the database's
+    unsigned char found;                // The database's quirks for the game loaded
+
+};                                      // end machine struct
+
+MACHINE *chip8_create(unsigned int rate)
+{
+    MACHINE *M = calloc(1, sizeof(MACHINE));
+    static const unsigned char none[1];
+
+    if(M == NULL)
+        return NULL;
+    M->ipf = rate > 0 ? rate : IPF;
+    M->quirks = QUIRKS_AUTO;
+    M->found = QUIRKS_DEFAULT;
+    boot_game(&M->C8, none, 0, NULL, M->ipf, QUIRKS_DEFAULT); // An empty game: memory of zeros runs as 0000, an unknown opcode
+    return M;
+}
+
+void chip8_destroy(MACHINE *M)
+{
+    if(M == NULL)
+        return;
+    unload_game(&M->C8);
+    free(M);
+}
+
+int chip8_load(MACHINE *M, const unsigned char *game, size_t size)
+{
+    unsigned char found = lookup_quirks(game, size);        // Not the ipf and quirks globals of the command line
+
+    unload_game(&M->C8);                                    // What the last game built, its block cache, profile or trace
+    if(boot_game(&M->C8, game, size, NULL, M->ipf, M->quirks >= 0 ? M->quirks : found) != 0)
+        return -1;
+    M->found = found;
+    return 0;
+}
+
+int chip8_quirks(MACHINE *M, const char *name)
+{
+    int q = name != NULL ? find_quirks(name) : QUIRKS_AUTO;
+
+    if(name != NULL && q < 0)
+        return -1;
+    M->quirks = q;
+    set_quirks(&M->C8, q >= 0 ? q : M->found);              // Back to the database's for the game already loaded
+    return 0;
+}
+
+int chip8_quirk_db(const char *path)
+{
+    return load_quirk_db(path);
+}
+
+void chip8_seed(MACHINE *M, uint32_t seed)
+{
+    seed_random(&M->C8, seed);
+}
+
+void chip8_set_keys(MACHINE *M, uint16_t keys)
+{
+    int i;
+    for(i = 0; i < KEYNUM; i++)
+        M->C8.key[i] = (keys >> i) & 1;
+}
+
+unsigned long chip8_step(MACHINE *M, unsigned long n)
+{
+    CH *C8 = &M->C8;
+    unsigned long left = C8->tick < C8->ipf ? C8->ipf - C8->tick : 1; // As run_frame()
+
+    if(n > left)
+        n = left;
+    run_cycles(C8, n);
+    return n;
+}
+
+unsigned long chip8_run_frames(MACHINE *M, unsigned long frames)
+{
+    unsigned long executed = 0;
+
+    while(frames-- > 0)
+        executed += chip8_step(M, M->C8.ipf);
+    return executed;
+}
+
+unsigned long chip8_step_many(MACHINE **machines, int count, unsigned long n)
+{
+    unsigned long executed = 0;
+    int i;
+
+    for(i = 0; i < count; i++)
+    {
+        if(i + 1 < count)                                   // The next one's registers, while this one runs
+            __builtin_prefetch(&machines[i + 1]->C8.pc);
+        executed += chip8_step(machines[i], n);
+    }
+    return executed;
+}
+
+int chip8_end_of_frame(const MACHINE *M)
+{
+    return M->C8.tick == 0;
+}
+
+const uint64_t *chip8_framebuffer(const MACHINE *M, int *width, int *height)
+{
+    if(width != NULL)
+        *width = M->C8.hires ? HIRES_W : W;
+    if(height != NULL)
+        *height = M->C8.hires ? HIRES_H : H;
+    return M->C8.graphics[0][0];
+}
+
+int chip8_drawn(MACHINE *M)
+{
+    int drawn = M->C8.draw;
+    M->C8.draw = 0;
+    return drawn;
+}
+
+int chip8_sound(const MACHINE *M)
+{
+    return M->C8.sound_timer > 0;
+}
+
+unsigned long chip8_unknown(const MACHINE *M)
+{
+    return M->C8.unknown;
+}
@@ -0,0 +1,74 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef LIBCHIP8_H_INCLUDED
+#define LIBCHIP8_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+ * Embedding API. The core with no window, no files, no SDL and none of
+ * the command line's globals, for programs that run many machines in one
+ * process:
+ *
+ *   cc -O2 -c libchip8.c chip8.c block.c display.c profile.c pack.c trace.c state.c quirks.c
+ *   ar rcs libchip8.a libchip8.o chip8.o block.o display.o profile.o pack.o trace.o state.o quirks.o
+ *
+ * and link with -lpthread. A MACHINE is one instance, created empty and
+ * given a game from memory. It only runs when told to, on the caller's
+ * thread, and never blocks: chip8_step() runs instructions up to the end
+ * of the current frame, the point where the 60 Hz timers tick and a host
+ * would present, and chip8_run_frames() whole frames. Each instance has
+ * its own instructions per frame and quirks; the only thing they share
+ * is the quirk database, read-only once chip8_quirk_db() has filled it,
+ * so different threads can run different ones at the same time.
+ *
+ * The screen is read in place through chip8_framebuffer(): two planes of
+ * 64 rows, each row two 64-bit words with the leftmost pixel in
+ * the top bit of the first, as CH.graphics. In 64x32 only the first word
+ * of the first 32 rows is used. The pointer stays valid for the life of
+ * the machine; what it points to changes when the machine runs.
+ */
+
+
+typedef struct Machine MACHINE;         // An instance, opaque to the host
+
+
+MACHINE *chip8_create(unsigned int);                      // A machine running that many instructions per frame, 0 for the default. NULL when out of memory
+void chip8_destroy(MACHINE *);
+int chip8_load(MACHINE *, const unsigned char *, size_t); // Reset the machine with a game of that many bytes. Returns -1 if it is too big
+void chip8_seed(MACHINE *, uint32_t);                     // Restart the random numbers of CXNN from a seed, for runs that repeat
+int chip8_quirks(MACHINE *, const char *);                // Run this game and the next ones with a quirk profile of quirks.h, NULL to take it from the database. Returns -1 if there is no such profile
+int chip8_quirk_db(const char *);                         // Add a quirk database file for every machine, before any runs. Returns -1 if it can't be read
+void chip8_set_keys(MACHINE *, uint16_t);                 // Keys down from now on, bit N for key N
+unsigned long chip8_step(MACHINE *, unsigned long);       // Run up to that many instructions, stopping at the end of the frame. Returns how many ran
+unsigned long chip8_run_frames(MACHINE *, unsigned long); // Run that many frames. Returns the instructions they took
+unsigned long chip8_step_many(MACHINE **, int, unsigned long); // chip8_step() on every machine of an array, in one call. Returns the instructions run by all
+int chip8_end_of_frame(const MACHINE *);                  // 1 when the last step stopped at the end of a frame
+const uint64_t *chip8_framebuffer(const MACHINE *, int *, int *); // The screen in place, giving its width and height in the current mode
+int chip8_drawn(MACHINE *);                               // 1 when the screen changed since the last call
+int chip8_sound(const MACHINE *);                         // 1 while the buzzer sounds
+unsigned long chip8_unknown(const MACHINE *);             // Unknown opcodes run since the game was loaded. PC stays on one, so a count that keeps growing is a stuck machine
+
+
+#endif // LIBCHIP8_H_INCLUDED
@@ -19,10 +19,161 @@
  * MA 02110-1301, USA.
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "chip8.h"
+#include "frontend.h"
+#include "headless.h"
+#include "batch.h"
+#include "profile.h"
+#include "pack.h"
+#include "trace.h"
+#include "audio.h"
+#include "quirks.h"
+
+/*
+ * Usage:
+ *   chip8                                  Ask for the game and open a window
+ *   chip8 game                             Open a window for the game
+ *   chip8 -software game                   The same, rendering without the GPU
+ *   chip8 -turbo game                      The same, as fast as the host can
+ *   chip8 -frameskip N game                The same, presenting one frame out of N + 1
+ *   chip8 -latency game                    The same, printing the input to photon latency at the end
+ *   chip8 -mute game                       The same, without sound
+ *   chip8 -audio N game                    The same, asking the sound device for N samples a callback, 256 by default
+ *   chip8 -profile out.json ...            Count instructions per handler, address and call stack, written out at the end
+ *   chip8 -stacks out.folded ...           The same, the call stacks in the collapsed format of flame graph tools
+ *   chip8 -trace out.trace ...             Record every instruction of the window or headless run
+ *   chip8 -replay file.trace               Run a trace again and report the first instruction that does something else
+ *   chip8 -mkpack out.pack game ...        Pack the games into one file
+ *   chip8 -pack games.pack ...             Look games up in a pack before the file system, in any mode
+ *   chip8 -ipf N ...                       Run N instructions per 60 Hz frame in any mode, 10 by default
+ *   chip8 -quirks profile ...              Run every game with a quirk profile in any mode: modern, chip8, schip or xochip
+ *   chip8 -quirkdb file ...                Take the profile of each game from a database, modern when it isn't there
+ *   chip8 -hash game ...                   Print the database line of each game, with the profile it gets
+ *   chip8 -headless [-n N | -f N] game     Run N instructions or N frames with no window and no delay
+ *         [-blocks]                        Run them through the basic block cache, experimental
+ *         [-wav out.wav]                   Write the sound of the run to a WAV file
+ *   chip8 -batch manifest [-n N] [-threads T] [-blocks]
+ *                                          Run every session of the manifest for N instructions on T threads
+ */
 
 int main(int argc, char *argv[])
 {
-    start();
+    int i, headless = 0, blocks = 0, threads = 0, ngames = 0;
+    unsigned long instructions = 1000000, frames = 0;
+    char *game = NULL, *manifest = NULL, *packing = NULL, *packed = NULL, *replay = NULL;
+    int hashing = 0;
+    unsigned long matched;
+    int result;
+    char **games = malloc(argc * sizeof(char *));
+    static PACK opened;
+
+    for(i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-headless") == 0)
+            headless = 1;
+        else if(strcmp(argv[i], "-software") == 0)
+            software = 1;
+        else if(strcmp(argv[i], "-turbo") == 0)
+            turbo = 1;
+        else if(strcmp(argv[i], "-latency") == 0)
+            latency = 1;
+        else if(strcmp(argv[i], "-mute") == 0)
+            mute = 1;
+        else if(strcmp(argv[i], "-audio") == 0 && i + 1 < argc)
+            audio_samples = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-wav") == 0 && i + 1 < argc)
+            wav_path = argv[++i];
+        else if(strcmp(argv[i], "-frameskip") == 0 && i + 1 < argc)
+            frameskip = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-profile") == 0 && i + 1 < argc)
+            profile_path = argv[++i];
+        else if(strcmp(argv[i], "-stacks") == 0 && i + 1 < argc)
+            stacks_path = argv[++i];
+        else if(strcmp(argv[i], "-trace") == 0 && i + 1 < argc)
+            trace_path = argv[++i];
+        else if(strcmp(argv[i], "-replay") == 0 && i + 1 < argc)
+            replay = argv[++i];
+        else if(strcmp(argv[i], "-mkpack") == 0 && i + 1 < argc)
+            packing = argv[++i];
+        else if(strcmp(argv[i], "-pack") == 0 && i + 1 < argc)
+            packed = argv[++i];
+        else if(strcmp(argv[i], "-ipf") == 0 && i + 1 < argc)
+            ipf = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "-quirks") == 0 && i + 1 < argc)
+        {
+            if((quirks = find_quirks(argv[++i])) < 0){
+                printf("Error. No quirk profile %s! There are:\n", argv[i]);
+                for(i = 0; quirk_profiles[i].name != NULL; i++)
+                    printf("  %-8s %s\n", quirk_profiles[i].name, quirk_profiles[i].what);
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], "-quirkdb") == 0 && i + 1 < argc)
+        {
+            if(load_quirk_db(argv[++i]) != 0)
+                return 1;
+        }
+        else if(strcmp(argv[i], "-hash") == 0)
+            hashing = 1;
+        else if(strcmp(argv[i], "-blocks") == 0)
+            blocks = 1;
+        else if(strcmp(argv[i], "-batch") == 0 && i + 1 < argc)
+            manifest = argv[++i];
+        else if(strcmp(argv[i], "-threads") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            instructions = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+            frames = strtoul(argv[++i], NULL, 10);
+        else
+        {
+            game = argv[i];
+            if(games != NULL)
+                games[ngames++] = argv[i];
+        }
+    }
+
+    if(replay != NULL)
+    {
+        if((result = replay_trace(replay, &matched)) < 0){
+            printf("Error. Trace can't be read!\n");
+            return 1;
+        }
+        printf("instructions: %lu\n", matched);
+        return result;
+    }
+
+    if(packing != NULL)
+        return write_pack(packing, games, ngames) == 0 ? 0 : 1;
+
+    if(hashing)
+        return print_hashes(games, ngames) == 0 ? 0 : 1;
+
+    if(packed != NULL)
+    {
+        if(open_pack(&opened, packed, 1) != 0)
+            return 1;
+        pack = &opened;
+    }
+
+    if(manifest != NULL)
+        return run_batch_file(manifest, instructions, threads, blocks) == 0 ? 0 : 1;
+
+    if(headless)
+    {
+        if(game == NULL){
+            printf("Usage: %s -headless [-n instructions | -f frames] [-blocks] [-wav out.wav] game\n", argv[0]);
+            return 1;
+        }
+        return run_headless(game, instructions, frames, blocks) == 0 ? 0 : 1;
+    }
+
+    if(game == NULL)
+        start();
+    else
+        initalize(game);
     return 0;
 }
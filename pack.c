@@ -0,0 +1,255 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pack.h"
+
+PACK *pack = NULL;
+
+uint64_t fnv(const unsigned char *p, size_t n)              // FNV-1a, 64 bits
+{
+    uint64_t h = 14695981039346656037ULL;
+    while(n-- > 0)
+    {
+        h ^= *p++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+const char *basename_of(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash != NULL ? slash + 1 : path;
+}
+
+static uint64_t fnv_name(const char *name)
+{
+    return fnv((const unsigned char *)name, strlen(name));
+}
+
+int write_pack(const char *path, char **games, int count)
+{
+    PACKHEADER header;
+    PACKENTRY *entry = calloc(count > 0 ? count : 1, sizeof(PACKENTRY));
+    unsigned char *images = malloc((size_t)(count > 0 ? count : 1) * ROMMAX), *image;
+    int *seen, slots = 1, i, j, n = 0, nimages = 0, status = -1;
+    long size;
+    FILE *in, *out = NULL;
+    static const unsigned char zero[ROMMAX];
+
+    while(slots < 2 * count)
+        slots *= 2;
+    seen = malloc(slots * sizeof(int));                     // Images by hash, to store each content once
+    if(entry == NULL || images == NULL || seen == NULL)
+        goto done;
+    for(i = 0; i < slots; i++)
+        seen[i] = -1;
+
+    for(i = 0; i < count; i++)
+    {
+        image = images + (size_t)nimages * ROMMAX;
+        if((in = fopen(games[i], "rb")) == NULL){
+            printf("Error. Game %s not found!\n", games[i]);
+            continue;
+        }
+        fseek(in, 0L, SEEK_END);
+        size = ftell(in);
+        rewind(in);
+        if(size < 0 || size > ROMMAX || fread(image, 1, size, in) != (size_t)size){
+            printf("Error. Game %s too big or unreadable!\n", games[i]);
+            fclose(in);
+            continue;
+        }
+        fclose(in);
+        memset(image + size, 0, ROMMAX - size);
+
+        entry[n].hash = fnv(image, size);
+        entry[n].size = size;
+        snprintf(entry[n].name, PACK_NAME, "%s", basename_of(games[i]));
+        for(j = entry[n].hash & (slots - 1); seen[j] >= 0; j = (j + 1) & (slots - 1))
+            if(entry[seen[j]].hash == entry[n].hash && entry[seen[j]].size == entry[n].size
+               && memcmp(images + (size_t)entry[seen[j]].image * ROMMAX, image, ROMMAX) == 0)
+                break;
+        if(seen[j] >= 0)                                    // Same content as an earlier game
+            entry[n].image = entry[seen[j]].image;
+        else
+        {
+            seen[j] = n;
+            entry[n].image = nimages++;
+        }
+        n++;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+    header.version = PACK_VERSION;
+    header.count = n;
+    header.images = nimages;
+    header.first = (sizeof(header) + n * sizeof(PACKENTRY) + ROMMAX - 1) / ROMMAX * ROMMAX;
+
+    if((out = fopen(path, "wb")) == NULL){
+        printf("Error. Can't write %s!\n", path);
+        goto done;
+    }
+    if(fwrite(&header, sizeof(header), 1, out) != 1
+       || fwrite(entry, sizeof(PACKENTRY), n, out) != (size_t)n
+       || fwrite(zero, 1, header.first - sizeof(header) - n * sizeof(PACKENTRY), out) != header.first - sizeof(header) - n * sizeof(PACKENTRY)
+       || fwrite(images, ROMMAX, nimages, out) != (size_t)nimages)
+        printf("Error. Can't write %s!\n", path);
+    else
+        status = 0;
+    if(fclose(out) != 0)
+        status = -1;
+    if(status == 0)
+        printf("%d games, %d distinct, packed into %s\n", n, nimages, path);
+
+done:
+    free(entry);
+    free(images);
+    free(seen);
+    return status;
+}
+
+int open_pack(PACK *P, const char *path, int cache)
+{
+    struct stat st;
+    const PACKHEADER *h;
+    unsigned int i, j;
+    int fd;
+
+    memset(P, 0, sizeof(PACK));
+    if((fd = open(path, O_RDONLY)) < 0){
+        printf("Error. Pack %s not found!\n", path);
+        return -1;
+    }
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PACKHEADER)){
+        close(fd);
+        printf("Error. %s is not a pack!\n", path);
+        return -1;
+    }
+    P->length = st.st_size;
+    P->map = mmap(NULL, P->length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);                                              // The mapping stays
+    if(P->map == MAP_FAILED){
+        P->map = NULL;
+        printf("Error. Can't map %s!\n", path);
+        return -1;
+    }
+
+    h = P->header = (const PACKHEADER *)P->map;             // Everything the index says has to be inside the file
+    if(memcmp(h->magic, PACK_MAGIC, sizeof(h->magic)) != 0 || h->version != PACK_VERSION
+       || h->first % ROMMAX != 0 || h->first < sizeof(PACKHEADER) + (uint64_t)h->count * sizeof(PACKENTRY)
+       || h->first + (uint64_t)h->images * ROMMAX > P->length){
+        printf("Error. %s is not a valid pack!\n", path);
+        close_pack(P);
+        return -1;
+    }
+    P->entry = (const PACKENTRY *)(P->map + sizeof(PACKHEADER));
+    for(i = 0; i < h->count; i++)
+        if(P->entry[i].size > ROMMAX || P->entry[i].image >= h->images || memchr(P->entry[i].name, 0, PACK_NAME) == NULL){
+            printf("Error. %s is not a valid pack!\n", path);
+            close_pack(P);
+            return -1;
+        }
+
+    for(P->slots = 1; P->slots < 2 * (int)h->count; P->slots *= 2)
+        ;
+    P->byname = malloc(P->slots * sizeof(int));
+    P->decoded = calloc(h->images > 0 ? h->images : 1, sizeof(INSN *));
+    P->quirks = calloc(h->images > 0 ? h->images : 1, 1);
+    P->cache = cache;
+    if(P->byname == NULL || P->decoded == NULL || P->quirks == NULL){
+        close_pack(P);
+        return -1;
+    }
+    for(i = 0; i < (unsigned int)P->slots; i++)
+        P->byname[i] = -1;
+    for(i = 0; i < h->count; i++)                           // The first game of a name wins
+    {
+        for(j = fnv_name(P->entry[i].name) & (P->slots - 1); P->byname[j] >= 0; j = (j + 1) & (P->slots - 1))
+            if(strcmp(P->entry[P->byname[j]].name, P->entry[i].name) == 0)
+                break;
+        if(P->byname[j] < 0)
+            P->byname[j] = i;
+    }
+    return 0;
+}
+
+int find_pack(PACK *P, const char *name)
+{
+    unsigned int j;
+    name = basename_of(name);
+    for(j = fnv_name(name) & (P->slots - 1); P->byname[j] >= 0; j = (j + 1) & (P->slots - 1))
+        if(strcmp(P->entry[P->byname[j]].name, name) == 0)
+            return P->byname[j];
+    return -1;
+}
+
+int load_pack(CH *C8, PACK *P, int index)
+{
+    const PACKENTRY *e;
+    INSN **cached;
+
+    if(index < 0 || index >= (int)P->header->count)
+        return -1;
+    e = &P->entry[index];
+    cached = &P->decoded[e->image];
+    if(load_game(C8, P->map + P->header->first + (size_t)e->image * ROMMAX, ROMMAX, *cached) != 0)   // The whole padded image in one copy
+        return -1;
+    if(*cached != NULL && P->quirks[e->image] != C8->quirks) // Cached for other quirks: -quirks changed since, or the database
+        decode_memory(C8);
+    else if(P->cache && *cached == NULL && (*cached = malloc(sizeof(C8->decoded))) != NULL){
+        memcpy(*cached, C8->decoded, sizeof(C8->decoded));
+        P->quirks[e->image] = C8->quirks;
+    }
+    return 0;
+}
+
+void close_pack(PACK *P)
+{
+    unsigned int i;
+    if(P->decoded != NULL)
+        for(i = 0; i < P->header->images; i++)
+            free(P->decoded[i]);
+    free(P->decoded);
+    free(P->quirks);
+    free(P->byname);
+    if(P->map != NULL)
+        munmap((void *)P->map, P->length);
+    memset(P, 0, sizeof(PACK));
+}
+
+int prepare_game(CH *C8, char *name)
+{
+    int index;
+    if(pack != NULL && (index = find_pack(pack, name)) >= 0)
+        return load_pack(C8, pack, index);
+    return prepare_emulator(C8, name);
+}
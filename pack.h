@@ -0,0 +1,105 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+
+#ifndef PACK_H_INCLUDED
+#define PACK_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include "chip8.h"
+
+#define PACK_MAGIC "CH8PACK"            // First 8 bytes of a pack, with the terminating zero
+#define PACK_VERSION 1
+#define PACK_NAME 44                    // Bytes of a name in the index, with the terminating zero
+
+
+/*
+ * ROM packs. A pack is one file holding a whole corpus of games:
+ *
+ *   header      magic, version, number of entries and of images
+ *   index       one PACKENTRY per game: hash, size, image and name
+ *   images      each game zero-padded to ROMMAX bytes, starting at a
+ *               multiple of ROMMAX from the start of the file
+ *
+ * Games with the same content share one image. open_pack() maps the file
+ * once; an instance is loaded from it with a single bounded copy of the
+ * padded image, which also clears the rest of its memory, and with the
+ * instruction cache copied from the first instance that decoded the same
+ * image. Numbers are stored in the byte order of the host that wrote the
+ * pack.
+ *
+ * prepare_game() looks names up in the pack opened by -pack before going
+ * to the file system, so every mode can run games out of a pack.
+ */
+
+
+typedef struct PackHeader               // begin pack header struct
+{
+
+    char magic[8];                      // PACK_MAGIC
+    uint32_t version;                   // PACK_VERSION
+    uint32_t count;                     // Entries in the index
+    uint32_t images;                    // Distinct images
+    uint32_t first;                     // Offset of the first image, a multiple of ROMMAX
+
+}PACKHEADER;                            // end pack header struct
+
+typedef struct PackEntry                // begin pack entry struct
+{
+
+    uint64_t hash;                      // fnv() of the whole game, trailing zeros included: not the quirk database's hash_game()
+    uint32_t size;                      // Bytes of the game, at most ROMMAX
+    uint32_t image;                     // Which image holds it
+    uint32_t flags;                     // Reserved, 0
+    char name[PACK_NAME];               // File name it was packed from, without the directories
+
+}PACKENTRY;                             // end pack entry struct
+
+typedef struct Pack                     // begin open pack struct
+{
+
+    const unsigned char *map;           // The whole file
+    size_t length;
+    const PACKHEADER *header;
+    const PACKENTRY *entry;
+    int *byname;                        // Hash table of entry numbers by name, -1 for an empty slot
+    int slots;                          // Its size, a power of two
+    INSN **decoded;                     // Instruction cache of every image, NULL until an instance decoded it
+    unsigned char *quirks;              // The quirks each was decoded for
+    int cache;                          // Keep instruction caches
+
+}PACK;                                  // end open pack struct
+
+
+extern PACK *pack;                      // The pack opened by -pack, NULL for none
+
+uint64_t fnv(const unsigned char *, size_t);      // FNV-1a, 64 bits, of that many bytes
+const char *basename_of(const char *);            // A path without its directories
+int write_pack(const char *, char **, int);       // Pack that many game files into a new pack. Returns -1 on failure
+int open_pack(PACK *, const char *, int);         // Map a pack, keeping instruction caches if the last argument is set. Returns -1 if it isn't a valid pack
+int find_pack(PACK *, const char *);              // Entry of a game by name, -1 if it's not in the pack
+int load_pack(CH *, PACK *, int);                 // Reset an instance with the game of an entry. Not thread safe while caches are being filled
+void close_pack(PACK *);
+int prepare_game(CH *, char *);                   // prepare_emulator(), from the open pack when the game is in it
+
+
+#endif // PACK_H_INCLUDED
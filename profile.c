@@ -0,0 +1,231 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+
+#define HOTSPOTS 32                                         // Addresses listed by execution count in the JSON
+
+char *profile_path = NULL;
+char *stacks_path = NULL;
+
+static const char *const names[OPS] =
+{
+    [OP_DECODE] = "decode", [OP_UNKNOWN] = "unknown",
+    [OP_00E0] = "00E0", [OP_00EE] = "00EE", [OP_1NNN] = "1NNN", [OP_2NNN] = "2NNN",
+    [OP_3XNN] = "3XNN", [OP_4XNN] = "4XNN", [OP_5XY0] = "5XY0", [OP_6XNN] = "6XNN",
+    [OP_7XNN] = "7XNN", [OP_8XY0] = "8XY0", [OP_8XY1] = "8XY1", [OP_8XY2] = "8XY2",
+    [OP_8XY3] = "8XY3", [OP_8XY4] = "8XY4", [OP_8XY5] = "8XY5", [OP_8XY6] = "8XY6",
+    [OP_8XY7] = "8XY7", [OP_8XYE] = "8XYE", [OP_9XY0] = "9XY0", [OP_ANNN] = "ANNN",
+    [OP_BNNN] = "BNNN", [OP_CXNN] = "CXNN", [OP_DXYN] = "DXYN", [OP_EX9E] = "EX9E",
+    [OP_EXA1] = "EXA1", [OP_FX07] = "FX07", [OP_WAIT] = "FX07 wait", [OP_FX0A] = "FX0A",
+    [OP_FX15] = "FX15", [OP_FX18] = "FX18", [OP_FX1E] = "FX1E", [OP_FX29] = "FX29",
+    [OP_FX33] = "FX33", [OP_FX55] = "FX55", [OP_FX65] = "FX65",
+    [OP_00CN] = "00CN", [OP_00DN] = "00DN", [OP_00FB] = "00FB", [OP_00FC] = "00FC",
+    [OP_00FD] = "00FD", [OP_00FE] = "00FE", [OP_00FF] = "00FF", [OP_5XY2] = "5XY2",
+    [OP_5XY3] = "5XY3", [OP_FN01] = "FN01", [OP_FX30] = "FX30", [OP_FX75] = "FX75",
+    [OP_FX85] = "FX85", [OP_8XY1_VF] = "8XY1 VF", [OP_8XY2_VF] = "8XY2 VF", [OP_8XY3_VF] = "8XY3 VF",
+    [OP_8XY6_VY] = "8XY6 VY", [OP_8XYE_VY] = "8XYE VY", [OP_BXNN] = "BXNN", [OP_FX55_I] = "FX55 I",
+    [OP_FX65_I] = "FX65 I"
+};
+
+const char *op_name(int op)
+{
+    return op >= 0 && op < OPS && names[op] != NULL ? names[op] : "?";
+}
+
+static PATH *find_path(PROFILE *P)                          // The slot of the stack being run, taken if it's new
+{
+    int depth = P->depth < STACKS ? P->depth : STACKS, i;
+    unsigned int h = depth;
+    PATH *p;
+
+    for(i = 0; i < depth; i++)
+        h = h * 31 + P->frame[i];
+    for(i = 0; i < PATHS; i++)
+    {
+        p = &P->path[(h + i) & (PATHS - 1)];
+        if(p->depth < 0){
+            p->depth = depth;
+            memcpy(p->frame, P->frame, depth * sizeof(P->frame[0]));
+            return p;
+        }
+        if(p->depth == depth && memcmp(p->frame, P->frame, depth * sizeof(P->frame[0])) == 0)
+            return p;
+    }
+    return NULL;
+}
+
+PROFILE *start_profile(CH *C8)
+{
+    PROFILE *P;
+    int i;
+
+    if((P = calloc(1, sizeof(PROFILE))) == NULL)
+        return NULL;
+    for(i = 0; i < PATHS; i++)
+        P->path[i].depth = -1;
+    P->current = find_path(P);
+    C8->profile = P;
+    return P;
+}
+
+void count_insn(PROFILE *P, CH *C8, const INSN *in)
+{
+    P->instructions++;
+    P->ops[in->op]++;
+    P->heat[C8->pc & 0xFFF]++;
+    if(P->current != NULL)
+        P->current->count++;
+    else
+        P->lost++;
+
+    if(in->op == OP_2NNN)                                   // The instruction counts for the caller, what follows for the callee
+    {
+        if(P->depth < STACKS)
+            P->frame[P->depth] = in->opcode & 0x0FFF;
+        if(++P->depth > P->deepest)
+            P->deepest = P->depth;
+        P->current = find_path(P);
+    }
+    else if(in->op == OP_00EE && P->depth > 0)
+    {
+        P->depth--;
+        P->current = find_path(P);
+    }
+}
+
+void count_idle(PROFILE *P, CH *C8, unsigned long n)
+{
+    const INSN *in = &C8->decoded[C8->pc & 0xFFF];
+    P->instructions += n;
+    P->ops[in->op] += n;
+    P->heat[C8->pc & 0xFFF] += n;
+    if(P->current != NULL)
+        P->current->count += n;
+    else
+        P->lost += n;
+}
+
+int top_ops(PROFILE *P, int *op, int max)
+{
+    int i, j, count = 0;
+    for(i = 0; i < OPS; i++)                                // Insertion sort, there are only a few dozen
+    {
+        if(P->ops[i] == 0 || max == 0 || (count == max && P->ops[op[count - 1]] >= P->ops[i]))
+            continue;
+        if(count < max)
+            count++;
+        for(j = count - 1; j > 0 && P->ops[op[j - 1]] < P->ops[i]; j--)
+            op[j] = op[j - 1];
+        op[j] = i;
+    }
+    return count;
+}
+
+static void write_json(PROFILE *P, FILE *out)
+{
+    int i, j, hot[HOTSPOTS], nhot = 0, first = 1;
+
+    fprintf(out, "{\n  \"instructions\": %llu,\n  \"cpu_seconds\": %.6f,\n  \"render_seconds\": %.6f,\n  \"deepest_call\": %d,\n",
+            P->instructions, P->cpu, P->render, P->deepest);
+
+    fprintf(out, "  \"ops\": {");
+    for(i = 0; i < OPS; i++)
+    {
+        if(P->ops[i] == 0)
+            continue;
+        fprintf(out, "%s\n    \"%s\": %llu", first ? "" : ",", op_name(i), P->ops[i]);
+        first = 0;
+    }
+    fprintf(out, "\n  },\n");
+
+    for(i = 0; i < MEMOSZ; i++)                             // The hottest addresses, most first
+    {
+        if(P->heat[i] == 0 || (nhot == HOTSPOTS && P->heat[hot[nhot - 1]] >= P->heat[i]))
+            continue;
+        if(nhot < HOTSPOTS)
+            nhot++;
+        for(j = nhot - 1; j > 0 && P->heat[hot[j - 1]] < P->heat[i]; j--)
+            hot[j] = hot[j - 1];
+        hot[j] = i;
+    }
+    fprintf(out, "  \"hotspots\": [");
+    for(i = 0; i < nhot; i++)
+        fprintf(out, "%s\n    {\"pc\": \"0x%03X\", \"count\": %llu}", i ? "," : "", hot[i], P->heat[hot[i]]);
+    fprintf(out, "\n  ],\n");
+
+    fprintf(out, "  \"heat_base\": \"0x200\",\n  \"heat\": [");         // Every address of the game, in order
+    for(i = 0x200; i < MEMOSZ; i++)
+        fprintf(out, "%s%s%llu", i > 0x200 ? "," : "", (i & 0x3F) == 0 ? "\n    " : "", P->heat[i]);
+    fprintf(out, "\n  ]\n}\n");
+}
+
+static void write_stacks(PROFILE *P, FILE *out)
+{
+    PATH *p;
+    int i, f;
+
+    for(i = 0; i < PATHS; i++)
+    {
+        p = &P->path[i];
+        if(p->depth < 0 || p->count == 0)
+            continue;
+        fprintf(out, "main");
+        for(f = 0; f < p->depth; f++)
+            fprintf(out, ";0x%03X", p->frame[f]);
+        fprintf(out, " %llu\n", p->count);
+    }
+    if(P->lost > 0)
+        fprintf(out, "main;[lost] %llu\n", P->lost);
+}
+
+void stop_profile(CH *C8)
+{
+    PROFILE *P = C8->profile;
+    FILE *out;
+
+    if(P == NULL)
+        return;
+    if(profile_path != NULL)
+    {
+        if((out = fopen(profile_path, "w")) != NULL){
+            write_json(P, out);
+            fclose(out);
+        }
+        else
+            fprintf(stderr, "Can't write %s\n", profile_path);
+    }
+    if(stacks_path != NULL)
+    {
+        if((out = fopen(stacks_path, "w")) != NULL){
+            write_stacks(P, out);
+            fclose(out);
+        }
+        else
+            fprintf(stderr, "Can't write %s\n", stacks_path);
+    }
+    free(P);
+    C8->profile = NULL;
+}
@@ -0,0 +1,84 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+
+#ifndef PROFILE_H_INCLUDED
+#define PROFILE_H_INCLUDED
+
+#include <stdio.h>
+#include "chip8.h"
+
+#define PATHS 4096                      // Distinct call stacks kept apart, a power of two
+
+
+/*
+ * Execution profiler. An instance with a PROFILE hung off CH.profile runs
+ * through a counting loop in chip8.c, which hands every instruction to
+ * count_insn(): executions per handler, per address, and per call stack
+ * as traced by 2NNN and 00EE. Idle waits skipped by skip_idle() count for
+ * the wait at PC. Without a profile the only cost is one test per call of
+ * run_cycles() or cycles(); the block cache steps aside while profiling.
+ *
+ * The front end adds the time spent on the CPU and in render(). On the
+ * way out the counters go to JSON and the stacks to the collapsed format
+ * of flame graph tools, one "main;0x2A4;0x310 count" line per stack.
+ */
+
+
+typedef struct Path                     // begin call stack struct
+{
+
+    unsigned short int frame[STACKS];   // Entry points of the calls, outermost first
+    int depth;                          // -1 for a free slot
+    unsigned long long count;           // Instructions run with exactly this stack
+
+}PATH;                                  // end call stack struct
+
+typedef struct Profile                  // begin profile struct
+{
+
+    unsigned long long instructions;
+    unsigned long long ops[OPS];        // Executions per handler
+    unsigned long long heat[MEMOSZ];    // Executions per address
+    unsigned short int frame[STACKS];   // The stack being run
+    int depth;                          // Calls deep, may be more than STACKS frames on a runaway stack
+    int deepest;
+    PATH path[PATHS];
+    PATH *current;                      // Path of the stack being run, NULL when the table is full
+    unsigned long long lost;            // Instructions of stacks that found no room in the table
+    double cpu;                         // Seconds spent running instructions, as timed by the front end
+    double render;                      // And drawing them
+
+}PROFILE;                               // end profile struct
+
+
+extern char *profile_path;              // Write the counters there as JSON, NULL for none
+extern char *stacks_path;               // Write the call stacks there, NULL for none
+
+PROFILE *start_profile(CH *);           // Attach a profile to an instance. Returns it, NULL when out of memory
+void stop_profile(CH *);                // Write what was asked for and detach
+void count_insn(PROFILE *, CH *, const INSN *); // An instruction at PC is about to run
+void count_idle(PROFILE *, CH *, unsigned long); // That many cycles were skipped waiting at PC
+int top_ops(PROFILE *, int *, int);     // Handlers by executions, most first, into an array of that size. Returns how many
+const char *op_name(int);
+
+
+#endif // PROFILE_H_INCLUDED
@@ -0,0 +1,152 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+#include "quirks.h"
+#include "pack.h"
+
+int quirks = QUIRKS_AUTO;
+
+const QUIRKPROFILE quirk_profiles[] =
+{
+    { "modern", 0,                                              "shift VX, I left alone, BNNN on V0 (the default)" },
+    { "chip8",  QUIRK_VF_RESET | QUIRK_SHIFT_VY | QUIRK_MEMORY_I, "the COSMAC VIP: shift VY, I moved, VF reset by logic" },
+    { "schip",  QUIRK_JUMP_VX,                                  "SUPER-CHIP: shift VX, I left alone, BXNN on VX" },
+    { "xochip", QUIRK_SHIFT_VY | QUIRK_MEMORY_I,                "XO-CHIP: shift VY, I moved" },
+    { NULL, 0, NULL }
+};
+
+static QUIRKENTRY *db;                                      // Sorted by hash
+static int dbsize;
+
+int find_quirks(const char *name)
+{
+    int i;
+    for(i = 0; quirk_profiles[i].name != NULL; i++)
+        if(strcmp(quirk_profiles[i].name, name) == 0)
+            return quirk_profiles[i].quirks;
+    return -1;
+}
+
+const char *quirks_name(unsigned char q)
+{
+    int i;
+    for(i = 0; quirk_profiles[i].name != NULL; i++)
+        if(quirk_profiles[i].quirks == q)
+            return quirk_profiles[i].name;
+    return "custom";
+}
+
+uint64_t hash_game(const unsigned char *game, size_t size)  // fnv() without the trailing zeros
+{
+    while(size > 0 && game[size - 1] == 0)
+        size--;
+    return fnv(game, size);
+}
+
+static int by_hash(const void *a, const void *b)
+{
+    uint64_t x = ((const QUIRKENTRY *)a)->hash, y = ((const QUIRKENTRY *)b)->hash;
+    return x < y ? -1 : x > y;
+}
+
+int load_quirk_db(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[256], name[32];
+    unsigned long long hash;
+    QUIRKENTRY *grown;
+    int q, size = dbsize, line_no = 0;
+
+    if(f == NULL){
+        printf("Error. Quirk database %s not found!\n", path);
+        return -1;
+    }
+    while(fgets(line, sizeof(line), f) != NULL)
+    {
+        line_no++;
+        if(sscanf(line, "%llx %31s", &hash, name) != 2 || line[0] == '#')
+            continue;
+        if((q = find_quirks(name)) < 0){
+            printf("%s:%d: no profile %s\n", path, line_no, name);
+            continue;
+        }
+        if(dbsize == size)
+        {
+            size = size ? size * 2 : 64;
+            if((grown = realloc(db, size * sizeof(QUIRKENTRY))) == NULL)
+                break;
+            db = grown;
+        }
+        db[dbsize].hash = hash;
+        db[dbsize].quirks = q;
+        dbsize++;
+    }
+    fclose(f);
+    qsort(db, dbsize, sizeof(QUIRKENTRY), by_hash);
+    return 0;
+}
+
+unsigned char lookup_quirks(const unsigned char *game, size_t size)
+{
+    QUIRKENTRY key, *found;
+
+    if(dbsize == 0)                                         // No hashing when there's nothing to find
+        return QUIRKS_DEFAULT;
+    key.hash = hash_game(game, size);
+    found = bsearch(&key, db, dbsize, sizeof(QUIRKENTRY), by_hash);
+    return found != NULL ? found->quirks : QUIRKS_DEFAULT;
+}
+
+unsigned char game_quirks(const unsigned char *game, size_t size)
+{
+    return quirks >= 0 ? quirks : lookup_quirks(game, size);
+}
+
+int print_hashes(char **games, int count)
+{
+    unsigned char game[ROMMAX + 1];
+    size_t size;
+    FILE *f;
+    int i, result = 0;
+
+    for(i = 0; i < count; i++)
+    {
+        if((f = fopen(games[i], "rb")) == NULL){
+            printf("Error. Game %s not found!\n", games[i]);
+            result = -1;
+            continue;
+        }
+        size = fread(game, 1, sizeof(game), f);
+        fclose(f);
+        if(size > ROMMAX){
+            printf("Error. Game %s too big!\n", games[i]);
+            result = -1;
+            continue;
+        }
+        printf("%016llx %-8s # %s\n", (unsigned long long)hash_game(game, size), quirks_name(game_quirks(game, size)), basename_of(games[i]));
+    }
+    return result;
+}
@@ -0,0 +1,81 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef QUIRKS_H_INCLUDED
+#define QUIRKS_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define QUIRK_VF_RESET 0x01             // 8XY1, 8XY2 and 8XY3 set VF to 0
+#define QUIRK_SHIFT_VY 0x02             // 8XY6 and 8XYE shift VY into VX, not VX in place
+#define QUIRK_MEMORY_I 0x04             // FX55 and FX65 leave I after the last register
+#define QUIRK_JUMP_VX 0x08              // BNNN jumps to XNN plus VX, as BXNN
+#define QUIRKS_AUTO -1                  // Take the profile of a game from the database
+#define QUIRKS_DEFAULT 0                // What games not in the database get
+
+
+/*
+ * Quirk profiles. The interpreters games were written for disagree on a
+ * few instructions, and each profile is one set of readings: the bits of
+ * an instance's CH.quirks. decode_insn() turns every instruction that has
+ * a quirk into the op of its profile's reading, each with a handler of
+ * its own, so the profile costs nothing once the game is decoded.
+ *
+ * The database gives the profile of a game by its hash, the FNV-1a of the
+ * game with its trailing zeros dropped, so a game hashes the same from a
+ * file and from the padded image of a pack. It is a text file, a game a
+ * line: the hash in hex, the name of a profile and, after a #, anything.
+ * "chip8 -hash game ..." prints those lines.
+ */
+
+
+typedef struct Quirkprofile             // begin quirk profile struct
+{
+
+    const char *name;
+    unsigned char quirks;               // QUIRK_ bits
+    const char *what;                   // For the usage
+
+}QUIRKPROFILE;                          // end quirk profile struct
+
+typedef struct Quirkentry               // begin quirk database entry struct
+{
+
+    uint64_t hash;                      // hash_game() of the game
+    unsigned char quirks;
+
+}QUIRKENTRY;                            // end quirk database entry struct
+
+
+extern int quirks;                                // Profile given to every game, QUIRKS_AUTO to look each one up. Set by -quirks
+extern const QUIRKPROFILE quirk_profiles[];       // Ends with a NULL name
+
+int find_quirks(const char *);                    // Quirks of a profile by name, -1 if there is none
+const char *quirks_name(unsigned char);           // Name of the profile with those quirks, "custom" when none has them
+uint64_t hash_game(const unsigned char *, size_t); // The key of a game in the database
+int load_quirk_db(const char *);                  // Add the games of a database file. Returns -1 if it can't be read
+unsigned char lookup_quirks(const unsigned char *, size_t); // Profile of a game from the database, QUIRKS_DEFAULT when it isn't there
+unsigned char game_quirks(const unsigned char *, size_t);   // The profile load_game() gives a game: the one of -quirks, or lookup_quirks()
+int print_hashes(char **, int);                   // Print a database line for each of that many game files. Returns -1 if one can't be read
+
+
+#endif // QUIRKS_H_INCLUDED
@@ -0,0 +1,328 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "chip8.h"
+#include "state.h"
+
+static atomic_ulong stamps = 1;                             // Source of STATE.stamp, shared so a slot freed and allocated again can't look like the old one
+
+static void restore_page(CH *C8, const STATE *S, int page)
+{
+    memcpy(&C8->memory[page * PAGE], &S->memory[page * PAGE], PAGE);
+    invalidate_memory(C8, page * PAGE, PAGE);               // The code there may have changed
+}
+
+void save_state(CH *C8, STATE *S)
+{
+    int p;
+
+    if(C8->base == S && C8->stamp == S->stamp && S->stamp != 0) // Only what was written since this slot was last in step with the instance
+    {
+        for(p = 0; p < PAGES; p++)
+            if(C8->dirty & ((uint64_t)1 << p))
+                memcpy(&S->memory[p * PAGE], &C8->memory[p * PAGE], PAGE);
+    }
+    else
+        memcpy(S->memory, C8->memory, MEMOSZ);
+
+    memcpy(S->graphics, C8->graphics, sizeof(S->graphics));
+    memcpy(S->flags, C8->flags, REGISTER);
+    S->hires = C8->hires;
+    S->planes = C8->planes;
+    S->quirks = C8->quirks;
+    memcpy(S->V, C8->V, REGISTER);
+    memcpy(S->stack, C8->stack, sizeof(S->stack));
+    memcpy(S->key, C8->key, KEYNUM);
+    S->I = C8->I;
+    S->pc = C8->pc;
+    S->ps = C8->ps;
+    S->delay_timer = C8->delay_timer;
+    S->sound_timer = C8->sound_timer;
+    S->tick = C8->tick;
+    S->random = C8->random;
+    S->unknown = C8->unknown;
+    S->version = STATE_VERSION;
+    S->stamp = atomic_fetch_add(&stamps, 1);
+
+    C8->base = S;
+    C8->stamp = S->stamp;
+    C8->dirty = 0;
+}
+
+int restore_state(CH *C8, const STATE *S)
+{
+    int p;
+
+    if(S->version != STATE_VERSION)
+        return -1;
+
+    if(C8->base == S && C8->stamp == S->stamp && S->stamp != 0)
+    {
+        for(p = 0; p < PAGES; p++)
+            if(C8->dirty & ((uint64_t)1 << p))
+                restore_page(C8, S, p);
+    }
+    else
+    {
+        for(p = 0; p < PAGES; p++)                          // Only the pages that differ, so the rest of the instruction cache stays
+            if(memcmp(&C8->memory[p * PAGE], &S->memory[p * PAGE], PAGE) != 0)
+                restore_page(C8, S, p);
+    }
+
+    memcpy(C8->graphics, S->graphics, sizeof(S->graphics));
+    memcpy(C8->flags, S->flags, REGISTER);
+    C8->hires = S->hires;
+    C8->planes = S->planes;
+    set_quirks(C8, S->quirks);                              // A game from the database, or run with -quirks, is decoded its own way
+    memcpy(C8->V, S->V, REGISTER);
+    memcpy(C8->stack, S->stack, sizeof(S->stack));
+    memcpy(C8->key, S->key, KEYNUM);
+    C8->I = S->I;
+    C8->pc = S->pc;
+    C8->ps = S->ps;
+    C8->delay_timer = S->delay_timer;
+    C8->sound_timer = S->sound_timer;
+    C8->tick = S->tick;
+    C8->random = S->random;
+    C8->unknown = S->unknown;
+    C8->draw = 1;
+
+    C8->base = S;
+    C8->stamp = S->stamp;
+    C8->dirty = 0;
+    return 0;
+}
+
+
+/*
+ * Frame encoding: the XOR of the frame against a reference, as pairs of
+ * a run of zeros and a run of literal bytes, each length a varint.
+ */
+
+static size_t put_length(unsigned char *out, size_t n)
+{
+    size_t i = 0;
+    while(n >= 0x80)
+    {
+        out[i++] = (n & 0x7F) | 0x80;
+        n >>= 7;
+    }
+    out[i++] = n;
+    return i;
+}
+
+static size_t get_length(const unsigned char *in, size_t *n)
+{
+    size_t i = 0;
+    int shift = 0;
+    *n = 0;
+    do
+    {
+        *n |= (size_t)(in[i] & 0x7F) << shift;
+        shift += 7;
+    }while(in[i++] & 0x80);
+    return i;
+}
+
+static size_t encode(unsigned char *out, const unsigned char *frame, const unsigned char *ref, size_t n)
+{
+    size_t i = 0, o = 0, zeros, literals;
+
+    while(i < n)
+    {
+        for(zeros = 0; i + zeros < n && frame[i + zeros] == ref[i + zeros]; zeros++);
+        i += zeros;
+        for(literals = 0; i + literals < n && frame[i + literals] != ref[i + literals]; literals++);
+        o += put_length(out + o, zeros);
+        o += put_length(out + o, literals);
+        for(; literals > 0; literals--, i++)
+            out[o++] = frame[i] ^ ref[i];
+    }
+    return o;
+}
+
+static void decode(unsigned char *frame, const unsigned char *in, size_t length, const unsigned char *ref, size_t n)
+{
+    size_t i = 0, o = 0, zeros, literals;
+
+    memcpy(frame, ref, n);
+    while(i < length)
+    {
+        i += get_length(in + i, &zeros);
+        i += get_length(in + i, &literals);
+        o += zeros;
+        for(; literals > 0; literals--)
+            frame[o++] ^= in[i++];
+    }
+}
+
+int open_rewind(REWIND *R, size_t bytes, int frames, int interval)
+{
+    memset(R, 0, sizeof(REWIND));
+    R->buffer = malloc(bytes);
+    R->records = malloc(frames * sizeof(RECORD));
+    R->encoded = malloc(2 * sizeof(STATE) + 16);            // Alternating runs of one byte cost up to three bytes per two
+    if(R->buffer == NULL || R->records == NULL || R->encoded == NULL)
+    {
+        close_rewind(R);
+        return -1;
+    }
+    R->size = bytes;
+    R->capacity = frames;
+    R->interval = interval > 0 ? interval : 1;
+    R->keyframe = (unsigned long)-1;
+    return 0;
+}
+
+void close_rewind(REWIND *R)
+{
+    free(R->buffer);
+    free(R->records);
+    free(R->encoded);
+    R->buffer = NULL;
+    R->records = NULL;
+    R->encoded = NULL;
+}
+
+static RECORD *record(REWIND *R, int i)                     // i-th oldest frame
+{
+    return &R->records[(R->first + i) % R->capacity];
+}
+
+static void drop_oldest(REWIND *R)                          // Forget the oldest keyframe and the frames relative to it
+{
+    unsigned long key = record(R, 0)->key;
+    while(R->count > 0 && record(R, 0)->key == key)
+    {
+        R->first = (R->first + 1) % R->capacity;
+        R->count--;
+    }
+    if(R->count == 0)
+        R->head = 0;
+}
+
+static int place(REWIND *R, size_t length, size_t *at)      // Find room for a frame without touching the ones held
+{
+    size_t tail;
+
+    if(R->count == 0)
+    {
+        *at = 0;
+        return length <= R->size;
+    }
+    tail = record(R, 0)->offset;
+    if(R->head >= tail)                                     // Free space at the end and before the oldest frame
+    {
+        if(R->size - R->head >= length){
+            *at = R->head;
+            return 1;
+        }
+        if(length < tail){
+            *at = 0;
+            return 1;
+        }
+        return 0;
+    }
+    if(tail - R->head > length){                            // Strictly, so a full buffer never looks empty
+        *at = R->head;
+        return 1;
+    }
+    return 0;
+}
+
+static unsigned char zeros[sizeof(STATE)];                  // Reference of a keyframe
+
+void push_rewind(REWIND *R, CH *C8)
+{
+    RECORD *r;
+    size_t length, at;
+    int key;
+
+    save_state(C8, &R->scratch);
+    R->scratch.stamp = 0;                                   // Not part of the frame, and 0 says the slot is rewritten behind save_state()'s back
+
+    for(;;)
+    {
+        key = R->keyframe == (unsigned long)-1 || R->frame - R->keyframe >= (unsigned long)R->interval;
+        if(key)
+            length = encode(R->encoded, (unsigned char *)&R->scratch, zeros, sizeof(STATE));
+        else
+            length = encode(R->encoded, (unsigned char *)&R->scratch, (unsigned char *)&R->key, sizeof(STATE));
+
+        if(R->count < R->capacity && place(R, length, &at))
+            break;
+        if(R->count == 0)                                   // Doesn't fit even in an empty buffer
+            return;
+        if(record(R, 0)->key == R->keyframe)                // About to drop the keyframe this frame was encoded against
+            R->keyframe = (unsigned long)-1;
+        drop_oldest(R);
+    }
+
+    memcpy(R->buffer + at, R->encoded, length);
+    r = record(R, R->count);
+    r->offset = at;
+    r->length = length;
+    r->frame = R->frame;
+    if(key)
+    {
+        R->key = R->scratch;
+        R->keyframe = R->frame;
+    }
+    r->key = R->keyframe;
+    R->head = at + length;
+    R->count++;
+    R->frame++;
+}
+
+int pop_rewind(REWIND *R, CH *C8)
+{
+    RECORD *r, *k;
+    int i;
+
+    if(R->count == 0)
+        return -1;
+    r = record(R, R->count - 1);
+
+    if(R->keyframe != r->key)                               // Its keyframe isn't the one at hand: find it and decode it
+    {
+        for(i = 0; record(R, i)->frame != r->key; i++);
+        k = record(R, i);
+        decode((unsigned char *)&R->key, R->buffer + k->offset, k->length, zeros, sizeof(STATE));
+        R->keyframe = r->key;
+    }
+    if(r->frame == r->key)
+        R->scratch = R->key;
+    else
+        decode((unsigned char *)&R->scratch, R->buffer + r->offset, r->length, (unsigned char *)&R->key, sizeof(STATE));
+
+    R->head = r->offset;
+    R->count--;
+    R->frame = r->frame;                                    // The next push takes its place
+    if(r->frame == r->key)                                  // Its keyframe is gone with it
+        R->keyframe = (unsigned long)-1;
+
+    R->scratch.stamp = 0;
+    return restore_state(C8, &R->scratch);
+}
@@ -0,0 +1,112 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef STATE_H_INCLUDED
+#define STATE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include "chip8.h"
+
+#define STATE_VERSION 5                 // Bump when STATE changes
+
+
+/*
+ * Save states. A STATE is everything a machine needs to carry on: memory,
+ * registers, stack, timers, keys, screen and random number generator. The
+ * caches of CH are rebuilt from it on demand.
+ *
+ * Saving or restoring only copies the pages of memory written since the
+ * instance last saved into or restored from the same slot, so going back
+ * to a checkpoint again and again costs a few hundred bytes of copying.
+ *
+ * The rewind buffer keeps a history of frames in a fixed amount of memory:
+ * a keyframe every so often and, for the frames in between, the XOR
+ * against that keyframe with the runs of zeros squeezed out. When it is
+ * full the oldest keyframe goes, with its frames.
+ */
+
+
+typedef struct State                    // begin state struct
+{
+
+    uint32_t version;                   // STATE_VERSION
+    unsigned long stamp;                // Changes on every save, to tell whether a CH's dirty pages are relative to this. 0 if written some other way
+    unsigned char memory[MEMOSZ];
+    uint64_t graphics[PLANES][HIRES_H][2];
+    unsigned char hires;
+    unsigned char planes;
+    unsigned char quirks;
+    unsigned char flags[REGISTER];
+    unsigned char V[REGISTER];
+    unsigned short int I;
+    unsigned short int pc;
+    unsigned short int stack[STACKS];
+    unsigned short int ps;
+    unsigned char delay_timer;
+    unsigned char sound_timer;
+    unsigned int tick;                  // Instructions into the frame
+    unsigned char key[KEYNUM];
+    uint32_t random;
+    unsigned long unknown;              // Unknown opcodes run
+
+}STATE;                                 // end state struct
+
+typedef struct Record                   // begin rewind record struct
+{
+
+    size_t offset;                      // Where it starts in the buffer
+    size_t length;
+    unsigned long frame;                // Frame number
+    unsigned long key;                  // Frame number of its keyframe, itself for a keyframe
+
+}RECORD;                                // end rewind record struct
+
+typedef struct Rewind                   // begin rewind struct
+{
+
+    unsigned char *buffer;              // Encoded frames, one after another, wrapping around
+    size_t size;
+    size_t head;                        // Where the next frame goes
+    RECORD *records;                    // Ring of the frames held, oldest first
+    int capacity;
+    int first;
+    int count;
+    int interval;                       // Frames from one keyframe to the next
+    unsigned long frame;                // Number of the next frame
+    STATE key;                          // The keyframe the newest frames are relative to
+    unsigned long keyframe;             // Its frame number, or -1 when key holds nothing
+    STATE scratch;
+    unsigned char *encoded;             // Room for the worst case encoding of a frame
+
+}REWIND;                                // end rewind struct
+
+
+void save_state(CH *, STATE *);                   // Snapshot an instance into a slot
+int restore_state(CH *, const STATE *);           // Put an instance back to a snapshot. Returns -1 if the slot is from another version
+
+int open_rewind(REWIND *, size_t, int, int);      // Bytes of history, most frames, frames between keyframes. Returns -1 when out of memory
+void push_rewind(REWIND *, CH *);                 // Record the current frame
+int pop_rewind(REWIND *, CH *);                   // Go back to the last recorded frame and forget it. Returns -1 when there is no history left
+void close_rewind(REWIND *);
+
+
+#endif // STATE_H_INCLUDED
@@ -0,0 +1,378 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include "trace.h"
+#include "state.h"
+
+#define NAP_NS 1000000                                      // How long the writer sleeps on an empty ring
+
+char *trace_path = NULL;
+
+static int get(FILE *in, unsigned int bytes, unsigned long *value) // A field of that many bytes, low byte first. Returns -1 at the end of the file
+{
+    unsigned int i;
+    int c;
+
+    *value = 0;
+    for(i = 0; i < bytes; i++)
+    {
+        if((c = getc(in)) == EOF)
+            return -1;
+        *value |= (unsigned long)c << 8 * i;
+    }
+    return 0;
+}
+
+static void again(TRACEREC *r)                              // The record in r once more, for a run starting at r->pc
+{
+    if(!(r->flags & TRACE_PC))
+        r->end = r->pc + 2 * r->count;
+}
+
+static int decode(FILE *in, TRACEREC *r, unsigned int *repeats) // The next record, the run starting at r->pc. Returns -1 at the end of the file
+{
+    unsigned long flags, v;
+
+    if(get(in, 1, &flags) != 0 || get(in, 1, &v) != 0)
+        return -1;
+    if(flags & TRACE_REPEAT){                               // The one in r again, that time and v - 1 more
+        if(v == 0)
+            return -1;
+        *repeats = v - 1;
+        again(r);
+        return 0;
+    }
+    r->flags = flags;
+    r->count = v;
+    r->end = r->pc + 2 * r->count;                          // Straight on, unless it says otherwise
+    r->written = 0;
+    r->wrote = 0;
+    r->sum = 0;
+    if(flags & TRACE_PC){
+        if(get(in, 2, &v) != 0)
+            return -1;
+        r->end = v;
+    }
+    if(flags & TRACE_KEYS){
+        if(get(in, 2, &v) != 0)
+            return -1;
+        r->keys = v;
+    }
+    if(flags & TRACE_WRITE){
+        if(get(in, 2, &v) != 0)
+            return -1;
+        r->wrote = v;
+        if(get(in, 1, &v) != 0)
+            return -1;
+        r->written = v;
+        if(get(in, 4, &v) != 0)
+            return -1;
+        r->sum = v;
+    }
+    if(get(in, 4, &v) != 0)
+        return -1;
+    r->state = v;
+    return 0;
+}
+
+static void nap()
+{
+    struct timespec ts = { 0, NAP_NS };
+    nanosleep(&ts, NULL);
+}
+
+static void *writer(void *arg)                              // The thread streaming the ring to the file, the records are coded already
+{
+    TRACE *T = arg;
+    unsigned int head = 0, tail, len;
+    int done;
+
+    for(;;)
+    {
+        done = atomic_load_explicit(&T->done, memory_order_acquire);   // Before tail, so the last records are seen once it's set
+        tail = atomic_load_explicit(&T->tail, memory_order_acquire);
+        if(head == tail){
+            if(done)
+                break;
+            nap();
+            continue;
+        }
+        len = tail - head;
+        if(head % TRACEQ + len > TRACEQ)                    // Up to the end of the ring, the rest next time round
+            len = TRACEQ - head % TRACEQ;
+        fwrite(&T->ring[head % TRACEQ], 1, len, T->out);
+        T->bytes += len;
+        head += len;
+        atomic_store_explicit(&T->head, head, memory_order_release);
+    }
+    return NULL;
+}
+
+TRACE *start_trace(CH *C8, const char *path)
+{
+    TRACEHEADER header;
+    TRACE *T;
+    STATE *S;
+    FILE *out;
+    const struct State *base = C8->base;
+    unsigned long stamp = C8->stamp;
+    uint64_t dirty = C8->dirty;
+    int i;
+
+    if((out = fopen(path, "wb")) == NULL){
+        fprintf(stderr, "Can't write %s\n", path);
+        return NULL;
+    }
+    T = calloc(1, sizeof(TRACE));
+    S = malloc(sizeof(STATE));
+    if(T == NULL || S == NULL){
+        free(T);
+        free(S);
+        fclose(out);
+        return NULL;
+    }
+
+    save_state(C8, S);                                      // Where the run starts
+    C8->base = base;                                        // The instance stays in step with whatever slot it was
+    C8->stamp = stamp;
+    C8->dirty = dirty;
+    S->stamp = 0;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.ipf = C8->ipf;
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(S, sizeof(STATE), 1, out);
+    free(S);
+
+    T->out = out;
+    for(i = 0; i < KEYNUM; i++)                             // As the state has them, which is what replay starts from
+        T->keys |= (C8->key[i] != 0) << i;
+    T->free = TRACEQ;
+    atomic_init(&T->head, 0);
+    atomic_init(&T->tail, 0);
+    atomic_init(&T->done, 0);
+    if(pthread_create(&T->writer, NULL, writer, T) != 0){
+        fclose(out);
+        free(T);
+        return NULL;
+    }
+    C8->trace = T;
+    return T;
+}
+
+static unsigned int wait_trace(TRACE *T)                    // Hand over the bytes up to next and wait for room in the ring. Returns the bytes there is room for
+{
+    unsigned int used;
+
+    atomic_store_explicit(&T->tail, T->next, memory_order_release);
+    if(TRACEQ - (T->next - atomic_load_explicit(&T->head, memory_order_acquire)) < TRACE_MAXREC)
+        T->stalls++;
+    while(TRACEQ - (used = T->next - atomic_load_explicit(&T->head, memory_order_acquire)) < TRACE_MAXREC)
+        sched_yield();
+    return T->free = TRACEQ - used;
+}
+
+static void put_repeats(TRACE *T)                           // The record that says how many times the last one came again
+{
+    T->ring[T->next % TRACEQ] = TRACE_REPEAT;
+    T->ring[(T->next + 1) % TRACEQ] = T->repeats;
+    T->next += 2;
+    T->free -= 2;
+    T->repeats = 0;
+}
+
+void code_trace(CH *C8, unsigned int count, uint16_t start, int written, uint16_t wrote, uint16_t keys)
+{
+    TRACE *T = C8->trace;
+    unsigned char rec[TRACE_MAXREC], *q = rec + 2;
+    unsigned int len, at;
+    uint32_t sum;
+
+    memset(rec, 0, sizeof(rec));                            // Whole, so records compare whole
+    rec[1] = count;
+    if(C8->pc != (uint16_t)(start + 2 * count)){
+        rec[0] |= TRACE_PC;
+        q[0] = C8->pc;
+        q[1] = C8->pc >> 8;
+        q += 2;
+    }
+    if(keys != T->keys){
+        rec[0] |= TRACE_KEYS;
+        T->keys = keys;
+        q[0] = keys;
+        q[1] = keys >> 8;
+        q += 2;
+    }
+    if(written > 0){
+        rec[0] |= TRACE_WRITE;
+        sum = trace_sum(C8, wrote, written);
+        q[0] = wrote;
+        q[1] = wrote >> 8;
+        q[2] = written;
+        q[3] = sum;
+        q[4] = sum >> 8;
+        q[5] = sum >> 16;
+        q[6] = sum >> 24;
+        q += 7;
+    }
+    sum = trace_state(C8);
+    q[0] = sum;
+    q[1] = sum >> 8;
+    q[2] = sum >> 16;
+    q[3] = sum >> 24;
+    len = q + 4 - rec;
+
+    if(T->repeats < TRACE_RUN && memcmp(rec, T->last, sizeof(rec)) == 0){
+        T->repeats++;                                       // A loop going nowhere, or waiting for the timer to move the state
+        return;
+    }
+    if(T->free < TRACE_MAXREC)
+        T->free = wait_trace(T);
+    if(T->repeats > 0)
+        put_repeats(T);
+    at = T->next % TRACEQ;
+    memcpy(&T->ring[at], rec, sizeof(rec));                 // All of it, past the end into the slack if it has to
+    if(at + len > TRACEQ)                                   // Then round to the start
+        memcpy(T->ring, T->ring + TRACEQ, at + len - TRACEQ);
+    T->next += len;
+    T->free -= len;
+    memcpy(T->last, rec, sizeof(rec));
+    if(++T->runs % TRACE_BATCH == 0)                        // Hand them over a batch at a time
+        atomic_store_explicit(&T->tail, T->next, memory_order_release);
+}
+
+void stop_trace(CH *C8)
+{
+    TRACE *T = C8->trace;
+
+    if(T == NULL)
+        return;
+    if(T->repeats > 0){
+        if(T->free < TRACE_MAXREC)
+            T->free = wait_trace(T);
+        put_repeats(T);
+    }
+    atomic_store_explicit(&T->tail, T->next, memory_order_release);
+    atomic_store_explicit(&T->done, 1, memory_order_release);
+    pthread_join(T->writer, NULL);
+    fclose(T->out);
+    fprintf(stderr, "trace: %llu instructions in %llu bytes, the CPU waited on the writer %lu times\n", T->records, T->bytes, T->stalls);
+    free(T);
+    C8->trace = NULL;
+}
+
+static int differs(const TRACEREC *a, const TRACEREC *b)    // Field by field, the struct has padding
+{
+    return a->pc != b->pc || a->end != b->end || a->count != b->count || a->keys != b->keys
+        || a->wrote != b->wrote || a->written != b->written || a->sum != b->sum || a->state != b->state;
+}
+
+static void show(FILE *out, const char *what, const TRACEREC *r) // One line of a divergence report
+{
+    fprintf(out, "  %-9s pc 0x%03X, %3d instructions to 0x%03X, last opcode 0x%04X keys 0x%04X state 0x%08X",
+            what, r->pc, r->count, r->end, r->opcode, r->keys, (unsigned int)r->state);
+    if(r->written > 0)
+        fprintf(out, " wrote %d at 0x%03X sum 0x%08X", r->written, r->wrote, (unsigned int)r->sum);
+    fprintf(out, "\n");
+}
+
+int replay_trace(const char *path, unsigned long *matched)
+{
+    TRACEHEADER header;
+    TRACEREC want, got;
+    const INSN *insn;
+    STATE *S = malloc(sizeof(STATE));
+    CH *C8 = malloc(sizeof(CH));
+    FILE *in = fopen(path, "rb");
+    uint16_t pc;
+    unsigned char op;
+    unsigned int repeats = 0;
+    int i, result = -1;
+
+    *matched = 0;
+    if(S == NULL || C8 == NULL || in == NULL
+       || fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0
+       || header.version != TRACE_VERSION || fread(S, sizeof(STATE), 1, in) != 1
+       || load_game(C8, S->memory + 0x200, ROMMAX, NULL) != 0 || restore_state(C8, S) != 0)
+    {
+        if(in != NULL)
+            fclose(in);
+        free(S);
+        free(C8);
+        return -1;
+    }
+    C8->ipf = header.ipf;
+    memset(&want, 0, sizeof(want));                         // The keys are carried over from run to run, starting with the state's
+    for(i = 0; i < KEYNUM; i++)
+        want.keys |= (C8->key[i] != 0) << i;
+
+    result = 0;
+    for(;;)
+    {
+        want.pc = C8->pc;
+        if(repeats > 0){
+            repeats--;
+            again(&want);
+        }
+        else if(decode(in, &want, &repeats) != 0)
+            break;
+        for(i = 0; i < KEYNUM; i++)                         // The keys are the input, the rest is what has to match
+            C8->key[i] = (want.keys >> i) & 1;
+        memset(&got, 0, sizeof(got));
+        got.pc = C8->pc;
+        got.keys = want.keys;
+        do                                                  // A run ends where the recording loop ends one, or where the trace's did
+        {
+            pc = C8->pc;
+            insn = &C8->decoded[pc & 0xFFF];
+            if(insn->op == OP_DECODE)
+                decode_insn(C8, pc & 0xFFF);
+            got.opcode = insn->opcode;
+            got.written = trace_write(C8, insn, &got.wrote);
+            op = insn->op;
+            cycles(C8);
+            got.count++;
+        } while(got.count < want.count && ((uint16_t)(C8->pc - pc - 2) & ~2) == 0 && got.written == 0 && op != OP_EX9E && op != OP_FX0A);
+        got.end = C8->pc;
+        got.sum = trace_sum(C8, got.wrote, got.written);
+        got.state = trace_state(C8);
+        want.opcode = got.opcode;
+        if(differs(&want, &got))
+        {
+            printf("diverged in the run from instruction %lu\n", *matched);
+            show(stdout, "trace", &want);
+            show(stdout, "replay", &got);
+            result = 1;
+            break;
+        }
+        *matched += want.count;
+    }
+    fclose(in);
+    free(S);
+    free(C8);
+    return result;
+}
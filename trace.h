@@ -0,0 +1,171 @@
+/*
+ * This is a Chip 8 Emulator
+ *
+ * Copyright (C) 2014 Urek Tribal.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2 of the
+ * License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ */
+
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "chip8.h"
+
+#define TRACE_MAGIC "CH8TRACE"
+#define TRACE_VERSION 4                 // Bump when the file format changes
+#define TRACEQ (1 << 20)                // Bytes the ring holds, a power of two
+#define TRACE_MAXREC 19                 // Most bytes coded at once: a record, and the repeat ahead of it
+#define TRACE_RUN 255                   // Most instructions a record covers
+#define TRACE_BATCH 256                 // Records written between two updates of the ring's tail
+
+enum                                    // What a record holds after its flags and count, before the state, in this order
+{
+    TRACE_PC = 0x01,                    // PC after the run, when it isn't 2 bytes an instruction past the start
+    TRACE_KEYS = 0x02,                  // The keys, when they changed since the last run
+    TRACE_WRITE = 0x04,                 // Where the last instruction wrote memory, how many bytes and their trace_sum()
+    TRACE_REPEAT = 0x08                 // The record before, as many more times as the count says. Nothing else follows
+};
+
+
+/*
+ * Execution traces. An instance with a TRACE hung off CH.trace runs one
+ * instruction at a time through a recording loop in chip8.c, idle waits
+ * included, and codes what it did into a ring of bytes. A record covers
+ * a run of instructions, up to one that jumps, writes memory or reads
+ * the keys; skips don't end it. It's a byte of TRACE_ flags, a byte
+ * counting the instructions, the fields the flags name, low byte first,
+ * and trace_state() after the run. A run also ends every TRACE_RUN
+ * instructions and where the CPU leaves the loop, since the keys can
+ * change there. A record the same as the last only bumps a count, so a
+ * loop waiting on the timer takes a record and a repeat a tick. Per
+ * instruction the CPU only compares PC and looks the opcode up, and
+ * code_trace() codes the record once per run, which keeps a trace under
+ * twice the time of the same run without one.
+ * The ring's one reader, a thread of its own, streams the records to
+ * the file, so the CPU never waits on the disk unless the ring fills up.
+ *
+ * The file is a header, the STATE the run started from, then the
+ * records. The header, the STATE and trace_state() follow the byte
+ * order of the host, like a save, so a trace only replays on a host of
+ * the same byte order.
+ *
+ * replay_trace() restores the state, decodes the records back into
+ * TRACERECs, feeds each one's keys to a fresh instance, steps it with
+ * cycles() through a run of its own, ended the same way, and stops at
+ * the first run that does not do what the trace says. A divergence is
+ * found to the run, a few instructions, rather than the instruction.
+ */
+
+
+typedef struct Tracerec                 // begin trace record struct
+{
+
+    uint8_t flags;                      // TRACE_ flags
+    uint16_t pc;                        // Address of the run's first instruction
+    uint16_t end;                       // PC after the run
+    uint8_t count;                      // Instructions in the run
+    uint16_t opcode;                    // Not in the file, the replay's own for its reports: the run's last
+    uint16_t keys;                      // Keys down while it ran, bit N for key N
+    uint16_t wrote;                     // Where its last instruction wrote memory
+    uint8_t written;                    // Bytes it wrote there, 0 for most
+    uint32_t sum;                       // trace_sum() of them after it ran
+    uint32_t state;                     // trace_state() after the run
+
+}TRACEREC;                              // end trace record struct
+
+typedef struct Traceheader              // begin trace header struct
+{
+
+    char magic[8];                      // TRACE_MAGIC
+    uint32_t version;                   // TRACE_VERSION
+    uint32_t ipf;                       // Instructions per frame of the run
+
+}TRACEHEADER;                           // end trace header struct
+
+typedef struct Trace                    // begin trace struct
+{
+
+    unsigned char ring[TRACEQ + TRACE_MAXREC];          // With room for a record to run past the end before it's copied round
+    atomic_uint head;                   // Next byte to write out, moved by the writer thread only
+    atomic_uint tail;                   // Bytes up to here are handed to the writer, moved by the CPU only
+    unsigned int next;                  // Next byte to fill, the CPU hands them over TRACE_BATCH records at a time
+    unsigned int free;                  // Bytes the CPU can fill before it looks at head again
+    unsigned int runs;                  // Records so far
+    unsigned char last[TRACE_MAXREC];   // The last record coded, zeros after it
+    unsigned int repeats;               // Times it came again since, not in the ring yet
+    atomic_int done;                    // Set when the CPU side is finished
+    FILE *out;
+    pthread_t writer;
+    uint16_t keys;                      // Those of the last run, the next record holds them when they changed
+    unsigned long long records;         // Instructions in the records
+    unsigned long long bytes;           // Written after the header and state
+    unsigned long stalls;               // Times the CPU found the ring full and waited
+
+}TRACE;                                 // end trace struct
+
+
+extern char *trace_path;                          // Where -trace writes, NULL when not tracing
+
+TRACE *start_trace(CH *, const char *);           // Hang a trace off an instance and start writing it from the current state. NULL if the file can't be written
+void stop_trace(CH *);                            // Flush, close and detach it
+void code_trace(CH *, unsigned int, uint16_t, int, uint16_t, uint16_t); // Put in the ring the record of a run: that many instructions from an address, the bytes the last wrote and where, the keys down
+int replay_trace(const char *, unsigned long *);  // Re-run a trace, giving the instructions that matched. Returns 0 when all did, 1 on a divergence, -1 if the file is unreadable
+
+static inline int trace_write(const CH *C8, const INSN *in, uint16_t *addr) // Bytes the instruction is about to write and where, 0 when it writes none
+{
+    *addr = C8->I & 0xFFF;
+    switch(in->op)
+    {
+        case OP_FX33:
+            return 3;
+        case OP_FX55:
+        case OP_FX55_I:
+            return in->x + 1;
+        case OP_5XY2:
+            return (in->x > in->y ? in->x - in->y : in->y - in->x) + 1;
+    }
+    *addr = 0;
+    return 0;
+}
+
+static inline uint32_t trace_sum(const CH *C8, uint16_t addr, int len) // FNV-1a of that many bytes of memory, wrapping past the end. 0 for none
+{
+    uint32_t h = 2166136261u;
+    int i;
+    if(len == 0)
+        return 0;
+    for(i = 0; i < len; i++)
+        h = (h ^ C8->memory[(addr + i) & 0xFFF]) * 16777619u;
+    return h;
+}
+
+static inline uint32_t trace_state(const CH *C8)        // A sum of the registers, I, the timers and CH.unknown, a few multiplies for all of them
+{
+    uint64_t lo, hi, h;
+    memcpy(&lo, C8->V, sizeof(lo));
+    memcpy(&hi, C8->V + 8, sizeof(hi));
+    h = (lo * 0x9E3779B97F4A7C15ull ^ hi) * 0xC2B2AE3D27D4EB4Full;
+    h = (h ^ C8->I ^ (uint64_t)C8->delay_timer << 16 ^ (uint64_t)C8->sound_timer << 24 ^ (uint64_t)(uint32_t)C8->unknown << 32) * 0x165667B19E3779F9ull;
+    return h ^ h >> 32;
+}
+
+
+#endif // TRACE_H_INCLUDED